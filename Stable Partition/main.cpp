@@ -6,37 +6,633 @@
 // constant memory overhead (according to the normal assumptions of the RAM model).
 
 // To use, call function 'stablepartition' and pass the datatype T, a vector of T elements, and a
-// boolean function that operates on one T element and returns whether it is in the 'true' or
-// 'false' section of the partition (where the 'true' portion comes before the 'false' portion
-// in the final partitioned vector).
+// boolean function (or function object) that operates on one T element and returns whether it is in
+// the 'true' or 'false' section of the partition (where the 'true' portion comes before the 'false'
+// portion in the final partitioned vector).
 
 // Example usage: stablepartition<int>(list, isEven);, where list is a vector of ints and isEven
 // is a boolean function that accepts one int value as its function parameter.
 
+// Run with arguments to use the command line tool instead of the examples, which partitions the lines of a text
+// file (see 'printUsage' below for the options).
+
 //-----------------------------------------------------------------------------------------------------------------------
 
 #include<iostream>
 #include<vector>
+#include<list>
+#include<forward_list>
+#include<deque>
+#include<algorithm>
+#include<iterator>
+#include<memory>
+#include<functional>
+#include<type_traits>
+#include<string>
+#include<thread>
+#include<cerrno>
+#include<stdint.h>
+#include<climits>
+#include<cstdlib>
+#include<cstring>
+#include<ctime>
+#include<chrono>
+
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+#if defined(__SSE2__)
+#include<immintrin.h>
+#elif defined(__ARM_NEON)
+#include<arm_neon.h>
+#endif
+
+// x86 kernels for newer instruction sets are compiled with per-function target attributes and picked at runtime
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_X86_DISPATCH 1
+#endif
 
 using namespace std;
 
 // Function prototypes for key stable partition components
 
-template<typename T>
-void stablepartition(std::vector<T>& list, bool (&test)(T));
+template<typename T, typename Predicate>
+void stablepartition(std::vector<T>& list, Predicate test);
 
-template<typename T>
-void merge(std::vector<T>& list, bool (&test)(T), int low, int middle, int high);
+template<typename T, typename Predicate>
+void stablepartition(std::vector<T>& list, Predicate test, int first, int last);
+
+template<typename T, typename Predicate>
+void merge(std::vector<T>& list, Predicate test, int low, int middle, int high);
 
 template<typename T>
 void swap(std::vector<T>& list, int a, int b);
 
+template<typename T, typename Predicate>
+int partitionpoint(const std::vector<T>& list, Predicate test);
+
+template<typename List, typename Predicate, typename Index>
+Index partitionpoint(const List& list, Predicate test, Index low, Index high);
+
+template<typename List, typename Predicate, typename Index>
+Index gallopingpartitionpoint(const List& list, Predicate test, Index low, Index high, Index hint);
+
 // Function prototypes for example boolean partition functions
 
 bool isEven(int value);
 
 bool firstHalf(char c);
 
+// Types and function prototypes for rotation
+
+enum RotateAlgorithm
+{
+    ROTATE_AUTO,                        // through a small stack buffer when possible, otherwise block swaps
+    ROTATE_REVERSAL,                    // three reversals
+    ROTATE_BLOCKSWAP,                   // repeated swaps of the smaller side into place
+    ROTATE_CYCLELEADER,                 // follows each cycle of the permutation, one move per element
+    ROTATE_BUFFERED,                    // through a heap buffer the size of the smaller side (not O(1) memory)
+    ROTATE_REMAP                        // by remapping whole pages where possible (Linux only, see 'remaprotate')
+};
+
+template<typename T>
+void rotate(std::vector<T>& list, int low, int middle, int high, RotateAlgorithm algorithm = ROTATE_AUTO);
+
+template<typename T>
+void reversalrotate(std::vector<T>& list, int low, int middle, int high);
+
+template<typename T>
+void blockswaprotate(std::vector<T>& list, int low, int middle, int high, bool finishInBuffer);
+
+template<typename T>
+void cycleleaderrotate(std::vector<T>& list, int low, int middle, int high);
+
+template<typename T>
+void bufferedrotate(std::vector<T>& list, int low, int middle, int high, std::true_type);
+
+template<typename T>
+void bufferedrotate(std::vector<T>& list, int low, int middle, int high, std::false_type);
+
+template<typename T>
+bool smallrotate(std::vector<T>& list, int low, int middle, int high, std::true_type);
+
+template<typename T>
+bool smallrotate(std::vector<T>& list, int low, int middle, int high, std::false_type);
+
+template<typename T>
+bool remaprotate(std::vector<T>& list, int low, int middle, int high, std::true_type);
+
+template<typename T>
+bool remaprotate(std::vector<T>& list, int low, int middle, int high, std::false_type);
+
+#ifdef __linux__
+void remapBytes(char* from, char* to, size_t length);
+
+void remapCopy(char* target, const char* source, size_t length);
+
+bool remapHeadroom();
+
+int readMapCountLimit();
+#endif
+
+// Function prototypes for merging sorted ranges in place
+
+template<typename T>
+void inplacemerge(std::vector<T>& list, int low, int middle, int high);
+
+template<typename T, typename Compare>
+void inplacemerge(std::vector<T>& list, int low, int middle, int high, Compare less);
+
+// Function prototypes for merging independently partitioned ranges
+
+template<typename Iterator, typename Predicate>
+Iterator mergepartitioned(Iterator first, Iterator middle, Iterator last, Predicate test);
+
+template<typename Iterator, typename Predicate>
+Iterator parallelmergepartitioned(std::vector<Iterator> bounds, Predicate test);
+
+template<typename T, typename Predicate>
+int stablepartitionparallel(std::vector<T>& list, Predicate test, int threads);
+
+// Types and function prototypes for a container that keeps itself partitioned
+
+// A sequence that is always stably partitioned by 'test': its 'true' elements in the order they were added, then its
+// 'false' elements in the order they were added. The two sections are stored as separate vectors, so appending is
+// amortized O(1) with one call to 'test', and the partition point is just the number of 'true' elements. Elements
+// are read-only through operator[], since changing one could move it to the other section.
+template<typename T, typename Predicate>
+struct PartitionedVector
+{
+    Predicate test;
+    std::vector<T> trues;
+    std::vector<T> falses;
+    
+    PartitionedVector(Predicate test) : test(test) {}
+    
+    const T& operator[](int i) const
+    {
+        return i < (int)trues.size() ? trues[i] : falses[i - (int)trues.size()];
+    }
+    int size() const { return (int)(trues.size() + falses.size()); }
+    int partitionPoint() const { return (int)trues.size(); }
+    
+    void push_back(const T& value)
+    {
+        if (test(value))
+            trues.push_back(value);
+        else
+            falses.push_back(value);
+    }
+};
+
+template<typename T, typename Predicate>
+void appendPartitioned(PartitionedVector<T, Predicate>& partitioned, const std::vector<T>& list);
+
+template<typename T, typename Predicate>
+void flattenPartitioned(const PartitionedVector<T, Predicate>& partitioned, std::vector<T>& list);
+
+// Types and function prototypes for rope lists
+
+// One node of a rope: a segment of a chunk of elements, plus the links that order the segments. The nodes form a
+// treap keyed implicitly by position (each node comes after its left subtree and before its right one, and has a
+// higher priority than its children), so splitting a rope at a position or joining two ropes takes O(log n)
+// expected time. Segments never overlap, but several can share one chunk once it has been split.
+template<typename T>
+struct RopeNode
+{
+    std::shared_ptr< std::vector<T> > chunk;
+    int offset;                         // index of the segment's first element within chunk
+    int length;                         // elements in the segment
+    int total;                          // elements in the segment and both subtrees
+    unsigned priority;
+    RopeNode* left;
+    RopeNode* right;
+};
+
+// A rope owns its nodes, freeing them when it is destroyed or rebuilt by 'makeRope'. It cannot be copied, since
+// two ropes sharing nodes would each free them; use flattenRope and makeRope to make an independent copy.
+template<typename T>
+struct Rope
+{
+    RopeNode<T>* root;
+    unsigned seed;                      // state for generating node priorities
+    int chunkSize;                      // elements per chunk, for chunks made by 'makeRope' and 'ropeCoalesce'
+    int segments;                       // nodes in the tree
+    int coalesceAt;                     // number of segments at which 'rotate' next merges short ones together
+    
+    Rope() : root(NULL), seed(12345), chunkSize(1), segments(0), coalesceAt(0) {}
+    ~Rope() { freeRope(*this); }
+    Rope(const Rope&) = delete;
+    Rope& operator=(const Rope&) = delete;
+    
+    int size() const { return root != NULL ? root->total : 0; }
+};
+
+template<typename T>
+void makeRope(const std::vector<T>& list, int chunkSize, Rope<T>& rope);
+
+template<typename T>
+void flattenRope(const Rope<T>& rope, std::vector<T>& list);
+
+template<typename T>
+void freeRope(Rope<T>& rope);
+
+template<typename T>
+T& ropeElement(Rope<T>& rope, int index);
+
+template<typename T>
+void rotate(Rope<T>& rope, int low, int middle, int high);
+
+template<typename T, typename Predicate>
+void stablepartition(Rope<T>& rope, Predicate test);
+
+template<typename T>
+RopeNode<T>* ropeNode(Rope<T>& rope, const std::shared_ptr< std::vector<T> >& chunk, int offset, int length);
+
+template<typename T>
+int ropeSplit(RopeNode<T>* node, int count, RopeNode<T>*& left, RopeNode<T>*& right);
+
+template<typename T>
+RopeNode<T>* ropeJoin(RopeNode<T>* left, RopeNode<T>* right);
+
+template<typename T>
+void ropeSegments(RopeNode<T>* node, std::vector<RopeNode<T>*>& segments);
+
+template<typename T>
+void ropeCoalesce(Rope<T>& rope, std::vector<RopeNode<T>*>& segments);
+
+template<typename T>
+void ropeRelink(Rope<T>& rope, const std::vector<RopeNode<T>*>& segments);
+
+// Types and function prototypes for partitioning run-length encoded lists
+
+// One run of a run-length encoded list: 'length' consecutive copies of 'value'
+template<typename T>
+struct Run
+{
+    T value;
+    int length;
+};
+
+template<typename T>
+void encodeRuns(const std::vector<T>& list, std::vector< Run<T> >& runs);
+
+template<typename T>
+void decodeRuns(const std::vector< Run<T> >& runs, std::vector<T>& list);
+
+template<typename T, typename Predicate>
+int stablepartitionruns(std::vector< Run<T> >& runs, Predicate test);
+
+// Function prototypes for partitioning linked lists
+
+template<typename T, typename Predicate>
+void stablepartition(std::list<T>& list, Predicate test);
+
+template<typename T, typename Predicate>
+void stablepartition(std::forward_list<T>& list, Predicate test);
+
+template<typename Node, typename Predicate>
+Node* stablepartitionlinked(Node*& head, Predicate test);
+
+// Types and function prototypes for partitioning chunked storage
+
+// A list stored as a sequence of separately allocated chunks of 'chunkSize' elements each (the last chunk may be
+// shorter). Whole chunks can be exchanged in O(1) by swapping the chunk vectors rather than their elements.
+template<typename T>
+struct ChunkedList
+{
+    int chunkSize;
+    int count;
+    std::vector< std::vector<T> > chunks;
+    
+    T& operator[](int i) { return chunks[i / chunkSize][i % chunkSize]; }
+    const T& operator[](int i) const { return chunks[i / chunkSize][i % chunkSize]; }
+    int size() const { return count; }
+};
+
+template<typename T>
+void makeChunkedList(const std::vector<T>& list, int chunkSize, ChunkedList<T>& chunked);
+
+template<typename T, typename Predicate>
+void stablepartition(ChunkedList<T>& list, Predicate test);
+
+template<typename T, typename Predicate>
+void stablepartition(std::deque<T>& list, Predicate test);
+
+template<typename List, typename Predicate>
+void blockpartition(List& list, Predicate test);
+
+template<typename List, typename Predicate>
+void blockmerge(List& list, Predicate test, int low, int middle, int high);
+
+template<typename List>
+void swapBlocks(List& list, int a, int b, int length);
+
+template<typename T>
+void swapBlocks(ChunkedList<T>& list, int a, int b, int length);
+
+// Types and function prototypes for partitioning with a fused transformation
+
+// Pass as a transformation to leave one side unchanged
+struct NoTransform
+{
+};
+
+template<typename T, typename Predicate, typename TrueTransform, typename FalseTransform>
+void stablepartitiontransform(std::vector<T>& list, Predicate test, TrueTransform transformTrue, FalseTransform transformFalse);
+
+template<typename T, typename Transform>
+void applyTransform(T& value, Transform transform);
+
+template<typename T>
+void applyTransform(T& value, NoTransform transform);
+
+// Types and function prototypes for partitioning with fused reductions
+
+// Wraps a reducer so that 'stablepartitiontransform' passes it each element instead of storing a new value
+template<typename Reducer>
+struct ReduceInto
+{
+    Reducer* reducer;
+};
+
+// Ready made reducer giving the count, sum, minimum and maximum of the elements it is passed (the last three are
+// only meaningful if count > 0)
+template<typename T>
+struct SideSummary
+{
+    int count;
+    T sum;
+    T min;
+    T max;
+    
+    SideSummary() : count(0), sum(), min(), max() {}
+    
+    void operator()(const T& value);
+};
+
+template<typename T, typename Predicate, typename TrueReducer, typename FalseReducer>
+void stablepartitionreduce(std::vector<T>& list, Predicate test, TrueReducer& reduceTrue, FalseReducer& reduceFalse);
+
+template<typename T, typename Reducer>
+void applyTransform(T& value, ReduceInto<Reducer> reduce);
+
+// Function prototypes for partitioning with a small scratch buffer
+
+template<typename T, typename Predicate>
+void stablepartitionbuffered(std::vector<T>& list, Predicate test);
+
+template<typename T, typename Predicate>
+void bufferedmerge(std::vector<T>& list, Predicate test, int low, int middle, int high, std::vector<T>& buffer);
+
+// Types and function prototypes for partitioning with a per-block purity summary
+
+enum BlockPurity
+{
+    MIXED_BLOCK = 0,                    // holds both 'true' and 'false' elements
+    TRUE_BLOCK = 1,                     // every element is 'true'
+    FALSE_BLOCK = 2                     // every element is 'false'
+};
+
+struct PuritySummary
+{
+    int blockShift;                     // log2 of the number of elements per block
+    std::vector<uint8_t> bits;          // 2 bits per block, 4 blocks per byte
+    
+    BlockPurity get(int block) const { return (BlockPurity)((bits[block >> 2] >> ((block & 3)*2)) & 3); }
+    void set(int block, BlockPurity purity)
+    {
+        int shift = (block & 3)*2;
+        bits[block >> 2] = (uint8_t)((bits[block >> 2] & ~(3 << shift)) | (purity << shift));
+    }
+};
+
+template<typename T, typename Predicate>
+void stablepartitionclustered(std::vector<T>& list, Predicate test, int blockShift = 6);
+
+template<typename T, typename Predicate>
+void summarizedmerge(std::vector<T>& list, Predicate test, PuritySummary& summary, int low, int middle, int high);
+
+// Function prototypes for partitioning with as few writes as possible
+
+template<typename T, typename Predicate>
+int stablepartitionwriteonce(std::vector<T>& list, Predicate test);
+
+int partitionedPosition(const std::vector<uint64_t>& selected, const std::vector<int>& ranks, int trues, int i);
+
+// Function prototypes for undoing a stable partition
+
+template<typename T, typename Predicate>
+void makeSelection(const std::vector<T>& list, Predicate test, std::vector<uint64_t>& selected);
+
+template<typename T>
+void stableunpartition(std::vector<T>& list, const std::vector<uint64_t>& selected);
+
+template<typename T>
+void stableunpartition(std::vector<T>& list, const std::vector<bool>& outcomes);
+
+template<typename T>
+void stableunpartitionparallel(std::vector<T>& list, const std::vector<uint64_t>& selected, int threads);
+
+int countSelected(const std::vector<uint64_t>& selected, int low, int high);
+
+// Types and function prototypes for partitioning by a given selection instead of a boolean function
+
+// Counts the selected elements from index low to index high (inclusive) of a selection bitmap
+struct BitmapCount
+{
+    const std::vector<uint64_t>* selected;
+    
+    int operator()(int low, int high) const { return countSelected(*selected, low, high); }
+};
+
+// Counts the selected elements from index low to index high (inclusive) of a sorted list of selected indexes
+struct IndexCount
+{
+    const std::vector<int>* indices;
+    
+    int operator()(int low, int high) const
+    {
+        return (int)(std::upper_bound(indices->begin(), indices->end(), high) -
+                     std::lower_bound(indices->begin(), indices->end(), low));
+    }
+};
+
+template<typename T>
+int stablepartition(std::vector<T>& list, const std::vector<uint64_t>& selected);
+
+template<typename T>
+int stablepartition(std::vector<T>& list, const std::vector<int>& indices);
+
+template<typename T, typename Count>
+int selectedpartition(std::vector<T>& list, Count count);
+
+int stablepartitioncompact(std::vector<int>& list, const std::vector<uint64_t>& selected);
+
+// Types and function prototypes for partitioning with weaker ordering guarantees
+
+// Which sections of the partition must keep their original relative order
+enum Stability
+{
+    STABLE,             // both sections, as 'stablepartition'
+    STABLE_TRUES,       // only the 'true' section; the 'false' elements may end up in any order
+    STABLE_FALSES,      // only the 'false' section; the 'true' elements may end up in any order
+    UNSTABLE            // neither section
+};
+
+template<typename T, typename Predicate>
+int stablepartition(std::vector<T>& list, Predicate test, Stability stability);
+
+template<typename T, typename Predicate>
+int semistablepartition(std::vector<T>& list, Predicate test, Stability stability);
+
+template<typename T, typename Predicate>
+int unstablepartition(std::vector<T>& list, Predicate test);
+
+// Types and function prototypes for line-oriented text input used by the command line tool
+
+// A single line (or field of a line) of text input. Points directly into the mapped input file, so splitting
+// the input into records never copies any of the text. 'selected' caches the result of the partitioning
+// function so that it is evaluated once per line rather than once per comparison during the partition.
+struct Record
+{
+    const char* data;
+    size_t length;
+    bool selected;
+};
+
+const char* findByte(const char* begin, const char* end, char c);
+
+void splitLines(const char* data, size_t size, std::vector<Record>& records);
+
+Record fieldOf(const Record& line, int column, char delimiter);
+
+int parseInt(const Record& r);
+
+bool recordSelected(Record r);
+
+const char* mapInputFile(const char* path, size_t& size);
+
+void unmapInputFile(const char* data, size_t size);
+
+bool writeRecords(int fd, const std::vector<Record>& records, int begin, int end);
+
+// Types and function prototypes for portable vector kernels
+
+// Kernels that work on several ints at once are written once against a small set of vector operations, and
+// instantiated for each 'lanes' backend: SSE2, SSE4.2, AVX2 and AVX-512 on x86, NEON on ARM, and a plain C++
+// backend that runs anywhere. The fastest backend the CPU supports is picked at startup, and can be changed at
+// runtime (see 'setSimdBackend'), so the scalar backend can be tested on any machine and its results compared with
+// the vector ones.
+enum SimdBackend
+{
+    SIMD_SCALAR, SIMD_SSE2, SIMD_SSE42, SIMD_AVX2, SIMD_AVX512, SIMD_NEON
+};
+
+bool simdBackendSupported(SimdBackend backend);
+
+SimdBackend bestSimdBackend();
+
+SimdBackend simdBackend();
+
+bool setSimdBackend(SimdBackend backend);
+
+const char* simdBackendName(SimdBackend backend);
+
+template<typename Lanes>
+int compactInts(const int* values, const bool* flags, int count, bool keep, int* out);
+
+#if defined(HAVE_X86_DISPATCH)
+__attribute__((target("avx2")))
+const char* findByteAvx2(const char* begin, const char* end, char c);
+#endif
+
+int compactInts(const int* values, const bool* flags, int count, bool keep, int* out);
+
+// Types and function prototypes for predicate expressions compiled at runtime
+
+// Expressions are C-like, over the int variables 'x' and 'c' (see 'compileExpression'), and compile to a flat
+// list of instructions for a stack machine. Each instruction operates on a whole column of values at once, so the
+// interpretive overhead is paid once per batch of elements instead of once per element.
+enum ExprOp
+{
+    OP_LOAD, OP_CONST,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_MODPOW2,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_AND, OP_OR, OP_NEG, OP_NOT
+};
+
+// For binary operators 'immediate' means the right hand side is 'operand' rather than the top of the stack.
+// For OP_LOAD 'operand' is the variable (column) index, for OP_CONST it is the value.
+struct ExprInstruction
+{
+    ExprOp op;
+    int operand;
+    bool immediate;
+};
+
+struct Expression
+{
+    std::vector<ExprInstruction> code;
+    int maxDepth;
+};
+
+bool compileExpression(const char* text, Expression& expr, std::string& error);
+
+template<typename Lanes>
+void evaluateExpression(const Expression& expr, const int* const* columns, int count, bool* results);
+
+void evaluateExpression(const Expression& expr, const int* const* columns, int count, bool* results);
+
+// Types and function prototypes for the binary partition file format
+
+// A partition file is this 64 byte header followed by the elements of a partitioned list, 'true' section first,
+// stored exactly as they are laid out in memory (so files are only portable between machines with the same
+// endianness and type layout). Because the header is a multiple of 64 bytes and mappings are page aligned, a
+// reader can map the file and use the payload directly as an array of elements, with no copying and no rescan
+// to find where the 'false' section begins.
+struct PartitionFileHeader
+{
+    char magic[8];              // "STBLPART"
+    uint32_t version;           // currently 1
+    uint32_t elementSize;       // sizeof the element type
+    uint64_t count;             // number of elements
+    uint64_t partitionPoint;    // index of the first 'false' element, or count if there are none
+    uint64_t payloadOffset;     // bytes from the start of the file to the first element
+    uint64_t checksum;          // FNV-1a hash of the payload bytes
+    char reserved[16];
+};
+
+// A mapped partition file. Elements [0, partitionPoint) of the payload are the 'true' section and elements
+// [partitionPoint, count) are the 'false' section.
+struct PartitionFileView
+{
+    const char* mapping;
+    size_t mappingSize;
+    const PartitionFileHeader* header;
+    const char* payload;
+};
+
+uint64_t checksumBytes(const char* data, size_t size);
+
+bool writeAll(int fd, const char* data, size_t size);
+
+template<typename T>
+bool writePartitionFile(const char* path, const std::vector<T>& list, int partitionPoint);
+
+bool openPartitionFile(const char* path, PartitionFileView& view, bool verify, std::string& error);
+
+void closePartitionFile(PartitionFileView& view);
+
+template<typename T>
+const T* partitionFileElements(const PartitionFileView& view);
+
+// Function prototype for the command line tool
+
+int runCommandLine(int argc, char* argv[]);
+
 //-----------------------------------------------------------------------------------------------------------------------
 
 // Follows mergesort methodology of partitioning two elements, then partitioning 4 elements composed of 2
@@ -48,19 +644,26 @@ bool firstHalf(char c);
 // In normal case (i.e., both subsets being merged are of lengths that are the appropriate power of 2 for the
 // current cycle), finding the middle element is obvious.
 
-// For edge cases, the middle is found manually before passing the subsets to the merge function.
-template<typename T>
-void stablepartition(std::vector<T>& list, bool (&test)(T))
+// For edge cases, the middle is where the previous cycle's last full size subset ends, since the remainder after it
+// was partitioned on its own in that cycle.
+template<typename T, typename Predicate>
+void stablepartition(std::vector<T>& list, Predicate test)
+{
+    stablepartition(list, test, 0, (int)list.size()-1);
+}
+
+// Same as above, but partitions only the elements from index 'first' to index 'last' (inclusive), leaving the rest
+// of the list untouched.
+template<typename T, typename Predicate>
+void stablepartition(std::vector<T>& list, Predicate test, int first, int last)
 {
-    int last = (int)list.size()-1;
-    
     int low, middle, high;
     
 	// for powers of two from 2 to 2N-1
-	for (int i = 2; i < 2*(last+1); i*=2)
+	for (int i = 2; i < 2*(last-first+1); i*=2)
 	{
-		// for each subset of size i in the list
-		for (int j = 0; j < last; j+=i)
+		// for each subset of size i in the range
+		for (int j = first; j < last; j+=i)
 		{
 			// edge case, end of list does not contain a full i elements
             // different high, plus we must find the middle
@@ -69,21 +672,13 @@ void stablepartition(std::vector<T>& list, bool (&test)(T))
                 low = j;
                 high = last;
                 
-                middle = -1;
-                // find middle (where there is a 'true' element to the right of a 'false' element)
-                // example: even element to the right of odd element when partioning function is isEven.
-                for (int k = low; k < high; k++)
-                {
-                    if (!test(list[k]) && test(list[k+1]))
-                    {
-                        middle = k+1;
-                        break;
-                    }
-                }
+                // the first i/2 elements and the rest were each partitioned in the previous cycle, so the only place
+                // a 'true' element can be to the right of a 'false' element is where they meet (if there is a rest)
+                middle = j+i/2;
                 
-                if (middle != -1)
+                if (middle <= high && !test(list[middle-1]) && test(list[middle]))
                     merge(list, test, low, middle, high);
-                // if middle still = -1, subset is already partitioned correctly so no merge call necessary
+                // otherwise subset is already partitioned correctly so no merge call necessary
             }
             
 			// normal case
@@ -104,46 +699,20 @@ void stablepartition(std::vector<T>& list, bool (&test)(T))
 
 // Function to merge two partitioned subsets into larger partioned subset, with O(n) runtime and O(1) memory overhead.
 
-// Trivial in case where the number of 'false' values in subset 1 is equivalent to the number of 'true' values in subset 2:
-// just perform that number of 1-1 swaps. Call that number k; the window created by the indexes used is of size 2k, & k swaps made.
-
-// If not equivalent, perform a number of swaps equal to the smaller of those two numbers, and adjust the window size in
-// the appropriate direction to create a new subproblem. This process is iterated as many times as necessary until both
-// sides of the window are equivalent, and such a final case always occurs even if it is necessary to go down to a k=1 scenario.
-// The total number of swaps is never more than the number of elements in the two subsets.
-template<typename T>
-void merge(std::vector<T>& list, bool (&test)(T), int low, int middle, int high)
+// Only the 'false' values at the end of subset 1 and the 'true' values at the start of subset 2 are out of place, and
+// they just need to trade places while keeping their order, which is a rotation of the window they form (see
+// 'rotate'). The number of elements moved is never more than three times the number of elements in the two subsets.
+template<typename T, typename Predicate>
+void merge(std::vector<T>& list, Predicate test, int low, int middle, int high)
 {
     // define important indexes that we will use
-    int correctBeforeHere = low;
-    while(test(list[correctBeforeHere]))
-        correctBeforeHere++;
-    
-    int correctFromHere = high;
-    while(!test(list[correctFromHere]))
-        correctFromHere--;
-    correctFromHere++;
-    
-    int movingFrontier = middle;
-    
-    int swapIndex;
-    
-    // ends when an even number of values have been swapped in the most recent iteration
-    while(correctBeforeHere != movingFrontier)
-    {
-        swapIndex = movingFrontier;
-        
-        while(swapIndex < correctFromHere)
-        {
-            if (correctBeforeHere == movingFrontier)
-                movingFrontier=swapIndex;
-            
-            swap(list, correctBeforeHere, swapIndex);
-            correctBeforeHere++;
-            swapIndex++;
-        }
-    }
+    // both subsets are already partitioned, so their boundaries can be searched for. list[middle-1] is 'false' and
+    // list[middle] is 'true', so galloping outwards from the middle finds them in time logarithmic in the size of
+    // the window that actually needs swapping, which is usually much smaller than the subsets when they are skewed
+    int correctBeforeHere = gallopingpartitionpoint(list, test, low, middle-1, middle-1);
+    int correctFromHere = gallopingpartitionpoint(list, test, middle, high, middle);
     
+    rotate(list, correctBeforeHere, middle, correctFromHere-1);
 }
 
 // Simple helper function, swaps two values in a vector
@@ -155,17 +724,77 @@ void swap(std::vector<T>& list, int a, int b)
     list[b] = temp;
 }
 
-// Example boolean function for passing to stablepartition, partitions based on whether an int is even or odd
-bool isEven(int value)
+// Finds the partition point of an already partitioned vector: the index of the first 'false' element, or the size
+// of the vector if every element is 'true'. Binary search, so O(log n) calls to the boolean function.
+template<typename T, typename Predicate>
+int partitionpoint(const std::vector<T>& list, Predicate test)
 {
-    return !(value%2);
+    return partitionpoint(list, test, 0, (int)list.size()-1);
 }
 
-// Example boolean function for passing to stablepartition, partitions whether a char is in the first half
-// of the alphabet (A-M) or the second half (N-Z). Assumes char passed is between 65 and 90, i.e., a capital letter.
-// Not truly a part of this implementation, just an example function; correct error checking between your vector
-// initialization and the boolean function used would be an important part of using this stablepartition implementation.
-bool firstHalf(char c)
+// Same as above, for the already partitioned elements from index low to index high (inclusive). Returns high+1 if
+// they are all 'true'. Works on any list type with operator[], and on any index type, so iterators can be searched
+// with their own difference_type.
+template<typename List, typename Predicate, typename Index>
+Index partitionpoint(const List& list, Predicate test, Index low, Index high)
+{
+    Index first = low;
+    Index count = high-low+1;
+    
+    while (count > 0)
+    {
+        Index step = count/2;
+        if (test(list[first+step]))
+        {
+            first += step+1;
+            count -= step+1;
+        }
+        else
+            count = step;
+    }
+    return first;
+}
+
+// Galloping (exponential) search version, for when the partition point is expected to be near 'hint'. Steps away
+// from hint by 1, 2, 4, ... elements until it passes the partition point, then binary searches the last step, for
+// O(log d) calls to the boolean function where d is the distance from hint to the partition point.
+template<typename List, typename Predicate, typename Index>
+Index gallopingpartitionpoint(const List& list, Predicate test, Index low, Index high, Index hint)
+{
+    Index known = hint;
+    Index step = 1;
+    
+    if (test(list[hint]))
+    {
+        // partition point is after hint; known is the furthest index known to be 'true'
+        while (known+step <= high && test(list[known+step]))
+        {
+            known += step;
+            step *= 2;
+        }
+        return partitionpoint(list, test, known+1, std::min(known+step, high+1)-1);
+    }
+    
+    // partition point is at or before hint; known is the earliest index known to be 'false'
+    while (known-step >= low && !test(list[known-step]))
+    {
+        known -= step;
+        step *= 2;
+    }
+    return partitionpoint(list, test, std::max(known-step+1, low), known-1);
+}
+
+// Example boolean function for passing to stablepartition, partitions based on whether an int is even or odd
+bool isEven(int value)
+{
+    return !(value%2);
+}
+
+// Example boolean function for passing to stablepartition, partitions whether a char is in the first half
+// of the alphabet (A-M) or the second half (N-Z). Assumes char passed is between 65 and 90, i.e., a capital letter.
+// Not truly a part of this implementation, just an example function; correct error checking between your vector
+// initialization and the boolean function used would be an important part of using this stablepartition implementation.
+bool firstHalf(char c)
 {
     if (c <= 'M')
         return true;
@@ -175,8 +804,4422 @@ bool firstHalf(char c)
 
 //-----------------------------------------------------------------------------------------------------------------------
 
-int main()
+// Rotation: exchanges the elements from index low to middle-1 with the elements from index middle to high
+// (inclusive), keeping the order within each, so that list[middle] ends up at index low. This is the step every
+// merge of two partitioned subsets comes down to, and is usable on its own in place of std::rotate.
+
+// ROTATE_AUTO is what 'merge' uses: block swaps, three moves per element but O(1) memory and friendly to the cache,
+// until the smaller side of what is left fits in 1KB, which for trivially copyable types is then copied out to the
+// stack with memcpy and the larger side memmoved over, two moves per element. Reversal also makes three moves per
+// element, with both ends of each reversal moving through memory at once; cycle leader makes only one, but jumps
+// around the range, which is only worth it when moves are expensive and the range fits in cache.
+
+// ROTATE_REMAP moves whole pages by changing the page tables rather than copying them. It is never chosen
+// automatically; see 'remaprotate' for when it is safe to use.
+template<typename T>
+void rotate(std::vector<T>& list, int low, int middle, int high, RotateAlgorithm algorithm)
+{
+    if (low >= middle || middle > high)
+        return;
+    
+    typename std::is_trivially_copyable<T>::type triviallyCopyable;
+    
+    switch (algorithm)
+    {
+        case ROTATE_REVERSAL:
+            reversalrotate(list, low, middle, high);
+            break;
+        case ROTATE_BLOCKSWAP:
+            blockswaprotate(list, low, middle, high, false);
+            break;
+        case ROTATE_CYCLELEADER:
+            cycleleaderrotate(list, low, middle, high);
+            break;
+        case ROTATE_BUFFERED:
+            bufferedrotate(list, low, middle, high, triviallyCopyable);
+            break;
+        case ROTATE_REMAP:
+            if (!remaprotate(list, low, middle, high, triviallyCopyable))
+                bufferedrotate(list, low, middle, high, triviallyCopyable);
+            break;
+        default:
+            blockswaprotate(list, low, middle, high, true);
+            break;
+    }
+}
+
+// Reverses each side, then the whole range
+template<typename T>
+void reversalrotate(std::vector<T>& list, int low, int middle, int high)
+{
+    std::reverse(list.begin() + low, list.begin() + middle);
+    std::reverse(list.begin() + middle, list.begin() + high+1);
+    std::reverse(list.begin() + low, list.begin() + high+1);
+}
+
+// Trivial in case where both sides are the same length: just swap them. If not, swap the smaller side with the
+// same number of elements at the far end of the larger side, which puts those elements in their final place, and
+// leaves a smaller rotation of what remains. This process is iterated as many times as necessary until both sides
+// are the same length, which always occurs eventually even if it is necessary to go down to a single swap. The total
+// number of swaps is never more than the length of the range.
+
+// A small side can take many steps to work its way across a large one, so with 'finishInBuffer' the rest is handed
+// to 'smallrotate' as soon as the smaller side fits in its buffer.
+template<typename T>
+void blockswaprotate(std::vector<T>& list, int low, int middle, int high, bool finishInBuffer)
+{
+    typename std::vector<T>::iterator begin = list.begin();
+    typename std::is_trivially_copyable<T>::type triviallyCopyable;
+    
+    while (low < middle && middle <= high)
+    {
+        if (finishInBuffer && smallrotate(list, low, middle, high, triviallyCopyable))
+            return;
+        
+        int first = middle-low;
+        int second = high+1-middle;
+        
+        if (first <= second)
+        {
+            // the first side trades places with the start of the second, which is then in place
+            std::swap_ranges(begin + low, begin + middle, begin + middle);
+            low = middle;
+            middle += first;
+        }
+        else
+        {
+            // the second side trades places with the end of the first, which is then in place
+            std::swap_ranges(begin + middle-second, begin + middle, begin + middle);
+            high = middle-1;
+            middle -= second;
+        }
+    }
+}
+
+// The element that ends up at index i comes from index i+k (wrapping around the range), where k is the length of the
+// first side, which splits the range into gcd(length, k) cycles. Each is followed from its first index, holding that
+// one element aside until the cycle comes back around.
+template<typename T>
+void cycleleaderrotate(std::vector<T>& list, int low, int middle, int high)
+{
+    int length = high-low+1;
+    int k = middle-low;
+    
+    int cycles = length;
+    for (int remainder = k; remainder != 0; )
+    {
+        int next = cycles % remainder;
+        cycles = remainder;
+        remainder = next;
+    }
+    
+    for (int start = 0; start < cycles; start++)
+    {
+        T held = std::move(list[low+start]);
+        int current = start;
+        
+        while (true)
+        {
+            int next = current+k < length ? current+k : current+k-length;
+            if (next == start)
+                break;
+            list[low+current] = std::move(list[low+next]);
+            current = next;
+        }
+        list[low+current] = std::move(held);
+    }
+}
+
+// Copies the smaller side out to a heap buffer, moves the larger side over and copies the buffer back in. Trivially
+// copyable types are copied as raw bytes.
+template<typename T>
+void bufferedrotate(std::vector<T>& list, int low, int middle, int high, std::true_type)
+{
+    int first = middle-low;
+    int second = high+1-middle;
+    T* data = &list[0];
+    
+    std::vector<char> buffer((size_t)std::min(first, second) * sizeof(T));
+    if (first <= second)
+    {
+        memcpy(&buffer[0], data + low, buffer.size());
+        memmove(data + low, data + middle, (size_t)second * sizeof(T));
+        memcpy(data + low + second, &buffer[0], buffer.size());
+    }
+    else
+    {
+        memcpy(&buffer[0], data + middle, buffer.size());
+        memmove(data + low + second, data + low, (size_t)first * sizeof(T));
+        memcpy(data + low, &buffer[0], buffer.size());
+    }
+}
+
+template<typename T>
+void bufferedrotate(std::vector<T>& list, int low, int middle, int high, std::false_type)
+{
+    typename std::vector<T>::iterator begin = list.begin();
+    
+    if (middle-low <= high+1-middle)
+    {
+        std::vector<T> buffer(std::make_move_iterator(begin + low), std::make_move_iterator(begin + middle));
+        std::move(begin + middle, begin + high+1, begin + low);
+        std::move(buffer.begin(), buffer.end(), begin + high+1 - buffer.size());
+    }
+    else
+    {
+        std::vector<T> buffer(std::make_move_iterator(begin + middle), std::make_move_iterator(begin + high+1));
+        std::move_backward(begin + low, begin + middle, begin + high+1);
+        std::move(buffer.begin(), buffer.end(), begin + low);
+    }
+}
+
+// Same as 'bufferedrotate' through a fixed 1KB stack buffer, so still O(1) memory. Returns false without doing
+// anything if the smaller side does not fit, or the type cannot be copied as raw bytes.
+template<typename T>
+bool smallrotate(std::vector<T>& list, int low, int middle, int high, std::true_type)
+{
+    char buffer[1024];
+    int first = middle-low;
+    int second = high+1-middle;
+    
+    if ((size_t)std::min(first, second) * sizeof(T) > sizeof(buffer))
+        return false;
+    
+    T* data = &list[0];
+    if (first <= second)
+    {
+        memcpy(buffer, data + low, (size_t)first * sizeof(T));
+        memmove(data + low, data + middle, (size_t)second * sizeof(T));
+        memcpy(data + low + second, buffer, (size_t)first * sizeof(T));
+    }
+    else
+    {
+        memcpy(buffer, data + middle, (size_t)second * sizeof(T));
+        memmove(data + low + second, data + low, (size_t)first * sizeof(T));
+        memcpy(data + low, buffer, (size_t)second * sizeof(T));
+    }
+    return true;
+}
+
+template<typename T>
+bool smallrotate(std::vector<T>&, int, int, int, std::false_type)
+{
+    return false;
+}
+
+// Rotation by remapping pages, for trivially copyable types on Linux. The larger side moves by the length of the
+// smaller side, so when the smaller side is a whole number of pages long the whole pages of the larger side can be
+// moved by mremap, and only the partial pages at its ends need copying. The smaller side is first moved out of the
+// way into a scratch mapping, at the same offset within its pages, then moved to its final place: also by remapping
+// if the larger side is a whole number of pages long, otherwise by copying, which is no more than the smaller side's
+// share of an ordinary rotation. Returns false without doing anything if the smaller side is not a whole number of
+// pages long, the range is under 32MB, the process is short of mappings (see 'remapHeadroom') or a scratch mapping
+// cannot be made.
+
+// Only for opt-in use. The list's elements must be in private anonymous memory, which on Linux is where large
+// allocations come from (remapping a view of a file would move the view without changing the file). It is also not
+// safe while other threads of the process are creating or removing mappings of their own, including other rotations
+// of this kind, since the page moves and the scratch mappings change the address space under them.
+template<typename T>
+bool remaprotate(std::vector<T>& list, int low, int middle, int high, std::true_type)
+{
+#ifdef __linux__
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t first = (size_t)(middle-low) * sizeof(T);
+    size_t second = (size_t)(high+1-middle) * sizeof(T);
+    size_t smaller = std::min(first, second);
+    
+    // each remap leaves the list split into more mappings, so it is kept for ranges big enough that copying them
+    // costs far more than the system calls
+    const size_t minimum = (size_t)32 << 20;
+    if (smaller % page != 0 || first + second < minimum || !remapHeadroom())
+        return false;
+    
+    char* begin = (char*)&list[low];
+    char* smallerSide = first <= second ? begin : begin + first;
+    
+    char* scratch = (char*)mmap(NULL, smaller + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (scratch == MAP_FAILED)
+        return false;
+    char* stash = scratch + (uintptr_t)smallerSide % page;
+    
+    remapBytes(smallerSide, stash, smaller);
+    if (first <= second)
+    {
+        remapBytes(begin + first, begin, second);
+        remapBytes(stash, begin + second, first);
+    }
+    else
+    {
+        remapBytes(begin, begin + second, first);
+        remapBytes(stash, begin, second);
+    }
+    
+    munmap(scratch, smaller + page);
+    return true;
+#else
+    return false;
+#endif
+}
+
+template<typename T>
+bool remaprotate(std::vector<T>&, int, int, int, std::false_type)
+{
+    return false;
+}
+
+#ifdef __linux__
+#ifndef MREMAP_DONTUNMAP
+#define MREMAP_DONTUNMAP 4
+#endif
+
+// Moves 'length' bytes from 'from' to 'to' like memmove, but when they are a whole number of pages apart the pages
+// entirely inside the source are moved with mremap rather than copied, and only the partial pages at its ends are
+// copied. The part of the source the destination does not cover is left with unspecified contents.
+
+// Pages are moved with MREMAP_DONTUNMAP, so the source stays mapped throughout (as empty pages) and no other mapping
+// can be placed in it. Kernels older than 5.7 reject that flag, and then, as on any other failure, the bytes are
+// copied instead. A failed mremap may already have unmapped its destination, so that is mapped again before the
+// copy (see 'remapCopy').
+void remapBytes(char* from, char* to, size_t length)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    ptrdiff_t distance = to - from;
+    char* pagesBegin = (char*)(((uintptr_t)from + page-1) & ~(uintptr_t)(page-1));
+    char* pagesEnd = (char*)((uintptr_t)(from + length) & ~(uintptr_t)(page-1));
+    
+    // a few pages are not worth the system calls
+    if (distance % (ptrdiff_t)page != 0 || pagesEnd < pagesBegin + 16*page)
+    {
+        memmove(to, from, length);
+        return;
+    }
+    
+    size_t pagesLength = (size_t)(pagesEnd - pagesBegin);
+    char* target = pagesBegin + distance;
+    int flags = MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP;
+    
+    // the partial pages are set aside first, since their destinations may be inside the pages being moved
+    std::vector<char> head(from, pagesBegin);
+    std::vector<char> tail(pagesEnd, from + length);
+    
+    // mremap cannot move pages onto themselves, so overlapping moves go by way of a scratch mapping
+    bool overlapping = target < pagesEnd && pagesBegin < target + pagesLength;
+    if (!overlapping)
+    {
+        // the source pages are untouched by a failed mremap, and do not overlap the destination
+        if (mremap(pagesBegin, pagesLength, pagesLength, flags, target) == MAP_FAILED)
+            remapCopy(target, pagesBegin, pagesLength);
+    }
+    else
+    {
+        void* scratch = mmap(NULL, pagesLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (scratch == MAP_FAILED)
+        {
+            memmove(to, from, length);
+            return;
+        }
+        
+        // nothing in the list has changed yet if the pages cannot be moved out to the scratch mapping
+        if (mremap(pagesBegin, pagesLength, pagesLength, flags, scratch) == MAP_FAILED)
+        {
+            munmap(scratch, pagesLength);
+            memmove(to, from, length);
+            return;
+        }
+        
+        // the pages are in the scratch mapping now, so if they cannot be moved on they are copied from there
+        if (mremap(scratch, pagesLength, pagesLength, flags, target) == MAP_FAILED)
+            remapCopy(target, (const char*)scratch, pagesLength);
+        munmap(scratch, pagesLength);
+    }
+    
+    if (!head.empty())
+        memcpy(to, &head[0], head.size());
+    if (!tail.empty())
+        memcpy(pagesEnd + distance, &tail[0], tail.size());
+}
+
+// Copies whole pages to 'target' after a failed mremap to it. The kernel unmaps the destination of a fixed mremap
+// before it gets to some of the checks that can fail, so the range is first mapped again in place; there is nothing
+// left to fall back on if even that fails, which only happens when the process is out of mappings altogether.
+void remapCopy(char* target, const char* source, size_t length)
+{
+    void* mapped = mmap(target, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (mapped == MAP_FAILED)
+    {
+        cerr << "Could not restore memory after a failed page remap: " << strerror(errno) << endl;
+        abort();
+    }
+    memcpy(target, source, length);
+}
+
+// Whether the process has few enough memory mappings for a rotation by remapping to add more. Every remap leaves
+// the list's memory split into more separate mappings, which the kernel never merges back, and each later remap of
+// it gets slower for it; unchecked, repeated rotations would reach the limit of vm.max_map_count, after which
+// mremap and even munmap start failing. Remapping stops once a sixteenth of the limit is in use.
+bool remapHeadroom()
+{
+    static const int limit = readMapCountLimit();
+    
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0)
+        return false;
+    
+    int mappings = 0;
+    char block[1 << 16];
+    ssize_t count;
+    while ((count = read(fd, block, sizeof(block))) > 0)
+        mappings += (int)std::count(block, block + count, '\n');
+    close(fd);
+    
+    return count == 0 && mappings < limit/16;
+}
+
+// Reads vm.max_map_count, assuming the kernel's default if it cannot be read
+int readMapCountLimit()
+{
+    int limit = 65530;
+    int fd = open("/proc/sys/vm/max_map_count", O_RDONLY);
+    if (fd >= 0)
+    {
+        char text[32] = {};
+        if (read(fd, text, sizeof(text)-1) > 0 && atoi(text) > 0)
+            limit = atoi(text);
+        close(fd);
+    }
+    return limit;
+}
+#endif
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Stable in-place merge of the sorted elements from index low to middle-1 with the sorted elements from index middle
+// to high (inclusive), using SymMerge (Kim & Kutzner): O(n log n) moves through 'rotate' and O(log n) comparisons
+// per merge level, with O(1) memory overhead. Equal elements keep their order, those of the first range first.
+
+// SymMerge splits the combined range at its midpoint and binary searches for the largest k such that the last k
+// elements of the first range all belong after the first k elements of the second range. Rotating those two blocks
+// past each other leaves two independent, smaller merges either side of the midpoint. As in 'stablepartition' the
+// recursion is unwound, here into a fixed stack of pending merges: each split halves the range, so at most one merge
+// per level of splitting is left waiting, and 64 entries is more than enough for any int-sized range.
+template<typename T>
+void inplacemerge(std::vector<T>& list, int low, int middle, int high)
+{
+    inplacemerge(list, low, middle, high, std::less<T>());
+}
+
+// Same as above, ordering elements by 'less' rather than operator<
+template<typename T, typename Compare>
+void inplacemerge(std::vector<T>& list, int low, int middle, int high, Compare less)
+{
+    // pending merges, each as [start, split) and [split, end)
+    int pending[64][3];
+    int count = 0;
+    
+    if (low < middle && middle <= high)
+    {
+        pending[0][0] = low;
+        pending[0][1] = middle;
+        pending[0][2] = high+1;
+        count = 1;
+    }
+    
+    while (count > 0)
+    {
+        count--;
+        int start = pending[count][0];
+        int split = pending[count][1];
+        int end = pending[count][2];
+        
+        // a lone element in either range just needs its insertion point
+        if (split-start == 1)
+        {
+            int position = (int)(std::lower_bound(list.begin() + split, list.begin() + end, list[start], less) - list.begin());
+            rotate(list, start, split, position-1);
+            continue;
+        }
+        if (end-split == 1)
+        {
+            int position = (int)(std::upper_bound(list.begin() + start, list.begin() + split, list[split], less) - list.begin());
+            rotate(list, position, split, split);
+            continue;
+        }
+        
+        int half = (start+end)/2;
+        int sum = half+split;
+        
+        int searchLow, searchHigh;
+        if (split > half)
+        {
+            searchLow = sum-end;
+            searchHigh = half;
+        }
+        else
+        {
+            searchLow = start;
+            searchHigh = split;
+        }
+        
+        // first index of the first range whose element belongs after its mirror image in the second range
+        while (searchLow < searchHigh)
+        {
+            int c = (searchLow+searchHigh)/2;
+            if (!less(list[sum-1-c], list[c]))
+                searchLow = c+1;
+            else
+                searchHigh = c;
+        }
+        int firstEnd = searchLow;
+        int secondEnd = sum-searchLow;
+        
+        rotate(list, firstEnd, split, secondEnd-1);
+        
+        if (start < firstEnd && firstEnd < half)
+        {
+            pending[count][0] = start;
+            pending[count][1] = firstEnd;
+            pending[count][2] = half;
+            count++;
+        }
+        if (half < secondEnd && secondEnd < end)
+        {
+            pending[count][0] = half;
+            pending[count][1] = secondEnd;
+            pending[count][2] = end;
+            count++;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Merging independently partitioned ranges, e.g. shards of a list partitioned on separate threads or by separate
+// processes writing into one mapping. These take random access iterators rather than a vector and indexes, so they
+// work on arrays, mapped files and the like.
+
+// Given [first, middle) and [middle, last), each already stably partitioned, stably partitions [first, last) in place
+// and returns its partition point (the first 'false' element, or last if there are none). O(n) time and O(1) memory:
+// this is 'merge', with the window rotated by std::rotate since 'rotate' works on vectors. Either range may be empty.
+template<typename Iterator, typename Predicate>
+Iterator mergepartitioned(Iterator first, Iterator middle, Iterator last, Predicate test)
+{
+    typedef typename std::iterator_traits<Iterator>::difference_type Index;
+    Index firstLength = middle - first;
+    Index length = last - first;
+    
+    Index correctBeforeHere = firstLength == 0 ? 0 :
+                              gallopingpartitionpoint(first, test, (Index)0, firstLength-1, firstLength-1);
+    Index correctFromHere = firstLength == length ? length :
+                            gallopingpartitionpoint(first, test, firstLength, length-1, firstLength);
+    
+    std::rotate(first + correctBeforeHere, middle, first + correctFromHere);
+    return first + correctBeforeHere + (correctFromHere - firstLength);
+}
+
+// Same as above for any number of adjacent, already stably partitioned shards, where shard i runs from bounds[i] to
+// bounds[i+1]. Neighbouring shards are merged in pairs, halving the number of shards each round, and the merges of a
+// round run on separate threads, so only the last round is a single merge over the whole range. With fewer than two
+// bounds there is no range to partition: one bound is an empty range and is returned, and no bounds at all returns a
+// value-initialized iterator.
+template<typename Iterator, typename Predicate>
+Iterator parallelmergepartitioned(std::vector<Iterator> bounds, Predicate test)
+{
+    if (bounds.size() < 2)
+        return bounds.empty() ? Iterator() : bounds.front();
+    
+    while (bounds.size() > 2)
+    {
+        std::vector<std::thread> workers;
+        for (size_t s = 0; s+2 < bounds.size(); s += 2)
+        {
+            Iterator first = bounds[s], middle = bounds[s+1], last = bounds[s+2];
+            workers.push_back(std::thread([=]() { mergepartitioned(first, middle, last, test); }));
+        }
+        for (size_t w = 0; w < workers.size(); w++)
+            workers[w].join();
+        
+        // each merged pair is one shard now, and an odd shard out at the end is left for the next round
+        std::vector<Iterator> merged;
+        for (size_t b = 0; b < bounds.size(); b += 2)
+            merged.push_back(bounds[b]);
+        if (bounds.size() % 2 == 0)
+            merged.push_back(bounds.back());
+        bounds.swap(merged);
+    }
+    
+    return std::partition_point(bounds.front(), bounds.back(), test);
+}
+
+// Stable partition on 'threads' threads: each thread partitions an equal shard of the list with 'stablepartition',
+// and the shards are then combined with 'parallelmergepartitioned'. Returns the partition point.
+template<typename T, typename Predicate>
+int stablepartitionparallel(std::vector<T>& list, Predicate test, int threads)
+{
+    int size = (int)list.size();
+    int shards = std::max(1, std::min(threads, size));
+    
+    std::vector<typename std::vector<T>::iterator> bounds;
+    std::vector<std::thread> workers;
+    for (int s = 0; s < shards; s++)
+    {
+        int first = (int)((long long)size * s / shards);
+        int last = (int)((long long)size * (s+1) / shards) - 1;
+        
+        bounds.push_back(list.begin() + first);
+        workers.push_back(std::thread([=, &list]() { stablepartition(list, test, first, last); }));
+    }
+    bounds.push_back(list.end());
+    
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+    
+    return (int)(parallelmergepartitioned(bounds, test) - list.begin());
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Bulk operations on a PartitionedVector
+
+// Appends a batch of elements, as if by push_back on each in order. The batch is tested once up front so each
+// section grows at most once.
+template<typename T, typename Predicate>
+void appendPartitioned(PartitionedVector<T, Predicate>& partitioned, const std::vector<T>& list)
+{
+    std::vector<bool> selected(list.size());
+    size_t trueCount = 0;
+    for (size_t i = 0; i < list.size(); i++)
+    {
+        selected[i] = partitioned.test(list[i]);
+        trueCount += selected[i];
+    }
+    
+    partitioned.trues.reserve(partitioned.trues.size() + trueCount);
+    partitioned.falses.reserve(partitioned.falses.size() + list.size() - trueCount);
+    for (size_t i = 0; i < list.size(); i++)
+    {
+        if (selected[i])
+            partitioned.trues.push_back(list[i]);
+        else
+            partitioned.falses.push_back(list[i]);
+    }
+}
+
+// Copies the contents out as a single stably partitioned vector
+template<typename T, typename Predicate>
+void flattenPartitioned(const PartitionedVector<T, Predicate>& partitioned, std::vector<T>& list)
+{
+    list.clear();
+    list.reserve(partitioned.trues.size() + partitioned.falses.size());
+    list.insert(list.end(), partitioned.trues.begin(), partitioned.trues.end());
+    list.insert(list.end(), partitioned.falses.begin(), partitioned.falses.end());
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Rope lists. A rope holds its elements in chunks, and its order as a tree of segments of those chunks, so a rotation
+// is three splits and three joins of the tree, O(log n) pointer operations no matter how many elements move. That
+// suits workloads that rotate and repartition huge lists over and over, converting to a vector only when a flat copy
+// is actually needed.
+
+// Every split can leave a short segment either side of the cut, so both operations merge runs of short neighbouring
+// segments back into whole chunks ('ropeCoalesce'): partitioning each time, since it visits every segment anyway,
+// and rotation whenever the number of segments has doubled since the last merge, which keeps it O(log n) amortized.
+
+// Builds a rope of the elements of list, in chunks of 'chunkSize' elements, replacing anything already in 'rope'
+template<typename T>
+void makeRope(const std::vector<T>& list, int chunkSize, Rope<T>& rope)
 {
+    freeRope(rope);
+    rope.seed = 12345;
+    rope.chunkSize = chunkSize;
+    
+    for (int i = 0; i < (int)list.size(); i += chunkSize)
+    {
+        int length = std::min(chunkSize, (int)list.size() - i);
+        std::shared_ptr< std::vector<T> > chunk(new std::vector<T>(list.begin() + i, list.begin() + i + length));
+        rope.root = ropeJoin(rope.root, ropeNode(rope, chunk, 0, length));
+    }
+    rope.coalesceAt = 2*rope.segments + 16;
+}
+
+// Copies the elements of a rope out to a vector, in order
+template<typename T>
+void flattenRope(const Rope<T>& rope, std::vector<T>& list)
+{
+    std::vector<RopeNode<T>*> segments;
+    ropeSegments(rope.root, segments);
+    
+    list.clear();
+    list.reserve((size_t)rope.size());
+    for (size_t s = 0; s < segments.size(); s++)
+    {
+        typename std::vector<T>::const_iterator begin = segments[s]->chunk->begin() + segments[s]->offset;
+        list.insert(list.end(), begin, begin + segments[s]->length);
+    }
+}
+
+// Frees every node of a rope, leaving it empty (chunks are freed along with the last segment that uses them)
+template<typename T>
+void freeRope(Rope<T>& rope)
+{
+    std::vector<RopeNode<T>*> segments;
+    ropeSegments(rope.root, segments);
+    
+    for (size_t s = 0; s < segments.size(); s++)
+        delete segments[s];
+    rope.root = NULL;
+    rope.segments = 0;
+}
+
+// Returns the element at 'index', in O(log n) expected time
+template<typename T>
+T& ropeElement(Rope<T>& rope, int index)
+{
+    RopeNode<T>* node = rope.root;
+    
+    while (true)
+    {
+        int leftTotal = node->left != NULL ? node->left->total : 0;
+        
+        if (index < leftTotal)
+            node = node->left;
+        else if (index < leftTotal + node->length)
+            return (*node->chunk)[node->offset + index - leftTotal];
+        else
+        {
+            index -= leftTotal + node->length;
+            node = node->right;
+        }
+    }
+}
+
+// Same as 'rotate' on a vector: exchanges the elements from index low to middle-1 with the elements from index middle
+// to high (inclusive). Cuts the rope into the part before the range, the two sides of the range and the part after
+// it, and joins them back together with the sides exchanged. No elements are moved, other than by the occasional
+// merge of short segments.
+template<typename T>
+void rotate(Rope<T>& rope, int low, int middle, int high)
+{
+    if (low >= middle || middle > high)
+        return;
+    
+    RopeNode<T> *before, *first, *second, *after;
+    rope.segments += ropeSplit(rope.root, high+1, second, after);
+    rope.segments += ropeSplit(second, middle, first, second);
+    rope.segments += ropeSplit(first, low, before, first);
+    
+    rope.root = ropeJoin(ropeJoin(before, second), ropeJoin(first, after));
+    
+    if (rope.segments >= rope.coalesceAt)
+    {
+        std::vector<RopeNode<T>*> segments;
+        ropeSegments(rope.root, segments);
+        ropeCoalesce(rope, segments);
+        ropeRelink(rope, segments);
+        rope.coalesceAt = 2*rope.segments + 16;
+    }
+}
+
+// Stable partition of a rope. Each segment is partitioned within its chunk by 'stablepartition', after which it is
+// its 'true' elements followed by its 'false' ones, and so can be split in two at its partition point. The rope is
+// then relinked as all of the 'true' segments followed by all of the 'false' ones, in their original order, which is
+// what the merges of 'stablepartition' would have produced by rotating them into place. Element moves are therefore
+// confined to within segments: O(n log c) for segments of c elements, plus O((n/c) log n) pointer operations, plus
+// the merging of the short segments left over into whole chunks.
+template<typename T, typename Predicate>
+void stablepartition(Rope<T>& rope, Predicate test)
+{
+    std::vector<RopeNode<T>*> segments;
+    ropeSegments(rope.root, segments);
+    
+    std::vector<RopeNode<T>*> trues, falses;
+    for (size_t s = 0; s < segments.size(); s++)
+    {
+        RopeNode<T>* segment = segments[s];
+        int first = segment->offset;
+        int last = segment->offset + segment->length - 1;
+        
+        stablepartition(*segment->chunk, test, first, last);
+        int split = partitionpoint(*segment->chunk, test, first, last);
+        
+        if (split == first)
+            falses.push_back(segment);
+        else if (split > last)
+            trues.push_back(segment);
+        else
+        {
+            segment->length = split - first;
+            trues.push_back(segment);
+            falses.push_back(ropeNode(rope, segment->chunk, split, last+1 - split));
+        }
+    }
+    
+    trues.insert(trues.end(), falses.begin(), falses.end());
+    ropeCoalesce(rope, trues);
+    ropeRelink(rope, trues);
+    rope.coalesceAt = 2*rope.segments + 16;
+}
+
+// Allocates a node for a single segment, with the next pseudorandom priority
+template<typename T>
+RopeNode<T>* ropeNode(Rope<T>& rope, const std::shared_ptr< std::vector<T> >& chunk, int offset, int length)
+{
+    rope.seed = rope.seed * 1664525u + 1013904223u;
+    
+    rope.segments++;
+    
+    RopeNode<T>* node = new RopeNode<T>;
+    node->chunk = chunk;
+    node->offset = offset;
+    node->length = length;
+    node->total = length;
+    node->priority = rope.seed;
+    node->left = NULL;
+    node->right = NULL;
+    return node;
+}
+
+// Splits the tree at 'node' into its first 'count' elements and the rest. A segment straddling the split is cut in
+// two, the second half taking over the first's priority so it can take its place above the first's right subtree.
+// Returns the number of nodes added, which is 1 if a segment was cut and 0 otherwise.
+template<typename T>
+int ropeSplit(RopeNode<T>* node, int count, RopeNode<T>*& left, RopeNode<T>*& right)
+{
+    if (node == NULL)
+    {
+        left = right = NULL;
+        return 0;
+    }
+    
+    int leftTotal = node->left != NULL ? node->left->total : 0;
+    int added = 0;
+    
+    if (count <= leftTotal)
+    {
+        added = ropeSplit(node->left, count, left, node->left);
+        right = node;
+    }
+    else if (count >= leftTotal + node->length)
+    {
+        added = ropeSplit(node->right, count - leftTotal - node->length, node->right, right);
+        left = node;
+    }
+    else
+    {
+        int cut = count - leftTotal;
+        
+        RopeNode<T>* tail = new RopeNode<T>(*node);
+        tail->offset += cut;
+        tail->length -= cut;
+        tail->left = NULL;
+        tail->total = tail->length + (tail->right != NULL ? tail->right->total : 0);
+        
+        node->length = cut;
+        node->right = NULL;
+        left = node;
+        right = tail;
+        added = 1;
+    }
+    
+    node->total = node->length + (node->left != NULL ? node->left->total : 0) + (node->right != NULL ? node->right->total : 0);
+    return added;
+}
+
+// Joins two trees, every element of 'left' coming before every element of 'right'
+template<typename T>
+RopeNode<T>* ropeJoin(RopeNode<T>* left, RopeNode<T>* right)
+{
+    if (left == NULL)
+        return right;
+    if (right == NULL)
+        return left;
+    
+    if (left->priority > right->priority)
+    {
+        left->right = ropeJoin(left->right, right);
+        left->total = left->length + (left->left != NULL ? left->left->total : 0) + left->right->total;
+        return left;
+    }
+    
+    right->left = ropeJoin(left, right->left);
+    right->total = right->length + right->left->total + (right->right != NULL ? right->right->total : 0);
+    return right;
+}
+
+// Collects the segments of a tree in order
+template<typename T>
+void ropeSegments(RopeNode<T>* node, std::vector<RopeNode<T>*>& segments)
+{
+    if (node == NULL)
+        return;
+    
+    ropeSegments(node->left, segments);
+    segments.push_back(node);
+    ropeSegments(node->right, segments);
+}
+
+// Merges each run of neighbouring segments shorter than a quarter of a chunk into a new chunk, as long as the run fits
+// in one. Afterwards any two neighbouring segments together hold at least a quarter of a chunk, so there are at most
+// about 8 segments per chunk's worth of elements however many times the rope has been cut.
+template<typename T>
+void ropeCoalesce(Rope<T>& rope, std::vector<RopeNode<T>*>& segments)
+{
+    int shortLength = std::max(1, rope.chunkSize/4);
+    size_t kept = 0;
+    
+    for (size_t s = 0; s < segments.size(); )
+    {
+        size_t end = s;
+        int length = 0;
+        while (end < segments.size() && segments[end]->length < shortLength &&
+               length + segments[end]->length <= rope.chunkSize)
+            length += segments[end++]->length;
+        
+        if (end - s < 2)
+        {
+            segments[kept++] = segments[s++];
+            continue;
+        }
+        
+        // segments never overlap, so their elements can be moved out even when the chunk is shared
+        std::shared_ptr< std::vector<T> > chunk(new std::vector<T>());
+        chunk->reserve((size_t)length);
+        for (; s < end; s++)
+        {
+            typename std::vector<T>::iterator begin = segments[s]->chunk->begin() + segments[s]->offset;
+            chunk->insert(chunk->end(), std::make_move_iterator(begin),
+                          std::make_move_iterator(begin + segments[s]->length));
+            delete segments[s];
+            rope.segments--;
+        }
+        segments[kept++] = ropeNode(rope, chunk, 0, length);
+    }
+    segments.resize(kept);
+}
+
+// Rebuilds the tree from a list of its segments in order
+template<typename T>
+void ropeRelink(Rope<T>& rope, const std::vector<RopeNode<T>*>& segments)
+{
+    rope.root = NULL;
+    for (size_t s = 0; s < segments.size(); s++)
+    {
+        segments[s]->left = segments[s]->right = NULL;
+        segments[s]->total = segments[s]->length;
+        rope.root = ropeJoin(rope.root, segments[s]);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Run-length encoded partitioning. Every element of a run has the same value, so when the partitioning function
+// depends only on the value, a whole run is either 'true' or 'false' and the runs themselves can be stably
+// partitioned as if they were single elements. The work then depends on the number of runs rather than the number
+// of elements, and the result is still run-length encoded.
+
+// Builds the run-length encoding of a list, merging equal neighbours into a single run
+template<typename T>
+void encodeRuns(const std::vector<T>& list, std::vector< Run<T> >& runs)
+{
+    runs.clear();
+    for (int i = 0; i < (int)list.size(); i++)
+    {
+        if (!runs.empty() && runs.back().value == list[i])
+            runs.back().length++;
+        else
+        {
+            Run<T> run;
+            run.value = list[i];
+            run.length = 1;
+            runs.push_back(run);
+        }
+    }
+}
+
+// Expands runs back into a plain list
+template<typename T>
+void decodeRuns(const std::vector< Run<T> >& runs, std::vector<T>& list)
+{
+    list.clear();
+    for (int i = 0; i < (int)runs.size(); i++)
+        list.insert(list.end(), runs[i].length, runs[i].value);
+}
+
+// Adapts a partitioning function on values to one on runs
+template<typename T, typename Predicate>
+struct RunTest
+{
+    Predicate test;
+    
+    bool operator()(const Run<T>& run) const
+    {
+        return test(run.value);
+    }
+};
+
+// Stably partitions a run-length encoded list by the value of each run, giving the same result as decoding,
+// partitioning and re-encoding. Runs of equal value that become adjacent (one from each side of a 'false' run that
+// moved out from between them) are merged, so the output is as short as possible. Returns the index of the first
+// 'false' run, or the number of runs if there are none.
+template<typename T, typename Predicate>
+int stablepartitionruns(std::vector< Run<T> >& runs, Predicate test)
+{
+    RunTest<T, Predicate> runTest = { test };
+    stablepartition< Run<T> >(runs, runTest);
+    
+    // merge neighbouring runs of equal value in place, counting how many merged runs are 'true'
+    int partitionPoint = 0;
+    int kept = 0;
+    for (int i = 0; i < (int)runs.size(); i++)
+    {
+        if (kept > 0 && runs[kept-1].value == runs[i].value)
+            runs[kept-1].length += runs[i].length;
+        else
+        {
+            runs[kept++] = runs[i];
+            if (test(runs[kept-1].value))
+                partitionPoint = kept;
+        }
+    }
+    runs.resize(kept);
+    
+    return partitionPoint;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Linked list partitioning. Nodes can be relinked in O(1) without moving any elements, so a linked list is
+// stably partitioned in a single O(n) pass with no need for 'merge': 'false' nodes are unlinked in order onto a
+// second list, which is then linked back on after the last 'true' node. Each element is tested exactly once.
+
+// Overload of stablepartition for std::list, using splice so that no element is copied or reallocated
+template<typename T, typename Predicate>
+void stablepartition(std::list<T>& list, Predicate test)
+{
+    std::list<T> falses;
+    
+    typename std::list<T>::iterator it = list.begin();
+    while (it != list.end())
+    {
+        typename std::list<T>::iterator next = it;
+        ++next;
+        if (!test(*it))
+            falses.splice(falses.end(), list, it);
+        it = next;
+    }
+    
+    list.splice(list.end(), falses);
+}
+
+// Overload of stablepartition for std::forward_list. Nodes can only be unlinked from after their predecessor, so
+// the pass keeps track of the last 'true' node seen and of the end of the 'false' list.
+template<typename T, typename Predicate>
+void stablepartition(std::forward_list<T>& list, Predicate test)
+{
+    std::forward_list<T> falses;
+    typename std::forward_list<T>::iterator falseTail = falses.before_begin();
+    typename std::forward_list<T>::iterator trueTail = list.before_begin();
+    
+    typename std::forward_list<T>::iterator it = list.begin();
+    while (it != list.end())
+    {
+        if (test(*it))
+        {
+            trueTail = it;
+            ++it;
+        }
+        else
+        {
+            // move the node after trueTail (which is 'it') to the end of falses
+            ++it;
+            falses.splice_after(falseTail, list, trueTail);
+            ++falseTail;
+        }
+    }
+    
+    list.splice_after(trueTail, falses);
+}
+
+// Stable partition for hand-rolled (intrusive) singly linked lists, where each Node has a 'next' pointer that is
+// NULL at the end of the list and 'test' is called with a reference to the node. Updates head to the new first
+// node and returns the first 'false' node, or NULL if there are none.
+template<typename Node, typename Predicate>
+Node* stablepartitionlinked(Node*& head, Predicate test)
+{
+    Node* falseHead = NULL;
+    Node** trueLink = &head;
+    Node** falseLink = &falseHead;
+    
+    for (Node* node = head; node != NULL; node = node->next)
+    {
+        if (test(*node))
+        {
+            *trueLink = node;
+            trueLink = &node->next;
+        }
+        else
+        {
+            *falseLink = node;
+            falseLink = &node->next;
+        }
+    }
+    
+    *falseLink = NULL;
+    *trueLink = falseHead;
+    return falseHead;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Chunked storage partitioning. Uses the same passes as 'stablepartition' and the same swapping strategy as
+// 'merge', but each iteration of merge's inner loop is expressed as swaps of whole blocks of elements, which the
+// storage type can then carry out in the cheapest way it has (see 'swapBlocks').
+
+// Copies a list into chunked storage
+template<typename T>
+void makeChunkedList(const std::vector<T>& list, int chunkSize, ChunkedList<T>& chunked)
+{
+    chunked.chunkSize = chunkSize;
+    chunked.count = (int)list.size();
+    chunked.chunks.clear();
+    for (int i = 0; i < chunked.count; i += chunkSize)
+        chunked.chunks.push_back(std::vector<T>(list.begin() + i, list.begin() + std::min(i + chunkSize, chunked.count)));
+}
+
+template<typename T, typename Predicate>
+void stablepartition(ChunkedList<T>& list, Predicate test)
+{
+    blockpartition(list, test);
+}
+
+// std::deque does not expose its chunks, so this gets the block structure of the chunked engine but swaps
+// element by element
+template<typename T, typename Predicate>
+void stablepartition(std::deque<T>& list, Predicate test)
+{
+    blockpartition(list, test);
+}
+
+// Same passes as 'stablepartition', for any list type with operator[] and size()
+template<typename List, typename Predicate>
+void blockpartition(List& list, Predicate test)
+{
+    int last = (int)list.size()-1;
+    
+    for (int i = 2; i < 2*(last+1); i*=2)
+    {
+        for (int j = 0; j < last; j+=i)
+        {
+            int low = j;
+            int high = std::min(j+i-1, last);
+            int middle = j+i/2;
+            
+            if (middle <= high && !test(list[middle-1]) && test(list[middle]))
+                blockmerge(list, test, low, middle, high);
+        }
+    }
+}
+
+// Same as 'merge', but with the inner loop split into block swaps. The inner loop of 'merge' swaps each element
+// with the one 'distance' places after it, for 'count' elements in a row; blocks of at most 'distance' elements do
+// not overlap, so swapping them one after another in order has exactly the same effect.
+template<typename List, typename Predicate>
+void blockmerge(List& list, Predicate test, int low, int middle, int high)
+{
+    int correctBeforeHere = gallopingpartitionpoint(list, test, low, middle-1, middle-1);
+    int correctFromHere = gallopingpartitionpoint(list, test, middle, high, middle);
+    
+    int movingFrontier = middle;
+    
+    while(correctBeforeHere != movingFrontier)
+    {
+        int distance = movingFrontier - correctBeforeHere;
+        int count = correctFromHere - movingFrontier;
+        
+        for (int done = 0; done < count; done += distance)
+            swapBlocks(list, correctBeforeHere + done, correctBeforeHere + done + distance, std::min(distance, count - done));
+        
+        // where 'merge' leaves the frontier: advanced by 'distance' each time the front of the window reaches it
+        movingFrontier = correctBeforeHere + distance * (1 + (count-1) / distance);
+        correctBeforeHere += count;
+    }
+}
+
+// Swaps the non-overlapping blocks [a, a+length) and [b, b+length), element by element
+template<typename List>
+void swapBlocks(List& list, int a, int b, int length)
+{
+    for (int k = 0; k < length; k++)
+        std::swap(list[a+k], list[b+k]);
+}
+
+// Chunked version: wherever both blocks cover a whole chunk at the same time, the chunks are swapped instead of
+// their elements. Otherwise it swaps contiguous runs up to the next chunk boundary of either block.
+
+// Blocks only line up with chunks when the 'true' and 'false' elements come in runs of whole chunks, e.g. records
+// appended a chunk's worth at a time, and that is what this engine is for: on such data it moves a fraction of the
+// elements a vector partition does (see the -t benchmarks). On data mixed more finely than that, nearly every swap
+// is element by element, and indexing through the chunks makes it slower than partitioning a vector.
+template<typename T>
+void swapBlocks(ChunkedList<T>& list, int a, int b, int length)
+{
+    int size = list.chunkSize;
+    
+    while (length > 0)
+    {
+        int offsetA = a % size;
+        int offsetB = b % size;
+        
+        if (offsetA == 0 && offsetB == 0 && length >= size)
+        {
+            list.chunks[a / size].swap(list.chunks[b / size]);
+            a += size;
+            b += size;
+            length -= size;
+            continue;
+        }
+        
+        int step = std::min(length, std::min(size - offsetA, size - offsetB));
+        T* x = &list.chunks[a / size][offsetA];
+        std::swap_ranges(x, x + step, &list.chunks[b / size][offsetB]);
+        a += step;
+        b += step;
+        length -= step;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Partitioning with a fused transformation. Stably partitions the list, then replaces each 'true' element x with
+// transformTrue(x) and each 'false' element with transformFalse(x), without a separate pass over the list to do it.
+
+// The two halves of the list are partitioned first, leaving one last merge. That merge already scans the leading
+// 'true' elements of the left half and the trailing 'false' elements of the right half, so those are transformed as
+// they are scanned. The elements between them are put in order by a rotation done with three reversals, and the last
+// reversal swaps every one of them straight into its final position, so they are transformed as they are swapped.
+// The partitioning function always sees the original values.
+template<typename T, typename Predicate, typename TrueTransform, typename FalseTransform>
+void stablepartitiontransform(std::vector<T>& list, Predicate test, TrueTransform transformTrue, FalseTransform transformFalse)
+{
+    int size = (int)list.size();
+    int half = size/2;
+    
+    if (half > 0)
+    {
+        stablepartition(list, test, 0, half-1);
+        stablepartition(list, test, half, size-1);
+    }
+    
+    int correctBeforeHere = 0;
+    while (correctBeforeHere < half && test(list[correctBeforeHere]))
+        applyTransform(list[correctBeforeHere++], transformTrue);
+    
+    int correctFromHere = size;
+    while (correctFromHere > half && !test(list[correctFromHere-1]))
+        applyTransform(list[--correctFromHere], transformFalse);
+    
+    // [correctBeforeHere, half) is all 'false' and [half, correctFromHere) is all 'true'
+    std::reverse(list.begin() + correctBeforeHere, list.begin() + half);
+    std::reverse(list.begin() + half, list.begin() + correctFromHere);
+    
+    int boundary = correctBeforeHere + (correctFromHere - half);
+    int a = correctBeforeHere;
+    int b = correctFromHere-1;
+    for (; a < b; a++, b--)
+    {
+        std::swap(list[a], list[b]);
+        if (a < boundary)
+            applyTransform(list[a], transformTrue);
+        else
+            applyTransform(list[a], transformFalse);
+        if (b < boundary)
+            applyTransform(list[b], transformTrue);
+        else
+            applyTransform(list[b], transformFalse);
+    }
+    
+    // middle element of an odd length window, which the reversal leaves where it is
+    if (a == b)
+    {
+        if (a < boundary)
+            applyTransform(list[a], transformTrue);
+        else
+            applyTransform(list[a], transformFalse);
+    }
+}
+
+template<typename T, typename Transform>
+void applyTransform(T& value, Transform transform)
+{
+    value = transform(value);
+}
+
+// Skips the store entirely for a side that is not transformed
+template<typename T>
+void applyTransform(T&, NoTransform)
+{
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Partitioning with fused reductions. Stably partitions the list and calls reduceTrue(x) for each 'true' element
+// and reduceFalse(x) for each 'false' element, using the same final merge as 'stablepartitiontransform' so that the
+// reductions cost no extra pass over the list. Each element is passed exactly once, but not in list order, so
+// reducers should not depend on the order they see elements in (counts, sums, minimums and maximums are all fine).
+// The reducers are passed by reference and hold the results afterwards.
+template<typename T, typename Predicate, typename TrueReducer, typename FalseReducer>
+void stablepartitionreduce(std::vector<T>& list, Predicate test, TrueReducer& reduceTrue, FalseReducer& reduceFalse)
+{
+    ReduceInto<TrueReducer> trueSide = { &reduceTrue };
+    ReduceInto<FalseReducer> falseSide = { &reduceFalse };
+    stablepartitiontransform(list, test, trueSide, falseSide);
+}
+
+template<typename T, typename Reducer>
+void applyTransform(T& value, ReduceInto<Reducer> reduce)
+{
+    (*reduce.reducer)(value);
+}
+
+template<typename T>
+void SideSummary<T>::operator()(const T& value)
+{
+    if (count == 0 || value < min)
+        min = value;
+    if (count == 0 || max < value)
+        max = value;
+    sum += value;
+    count++;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Partitioning with a small scratch buffer. Still O(1) memory overhead, since the buffer has a fixed size (4KB of
+// elements) no matter how long the list is, but much faster in practice for large lists:
+
+// - The first cycles of 'stablepartition' are replaced by a single pass that stably partitions each buffer-sized
+//   subset directly, moving its 'false' elements out to the buffer and back in after its 'true' ones. For 4 byte
+//   elements that does the work of the first 10 cycles in one pass, each element tested once.
+// - In the remaining cycles, when one side of a merge's window fits in the buffer the window is rotated through the
+//   buffer, two moves per element instead of the three of a swap. Larger windows fall back to 'rotate'.
+
+// (Borrowing the buffer from the list itself, as block merge sorts do, relies on being able to sort the borrowed
+// elements back into order afterwards, which needs distinct keys that a partitioning function cannot provide.)
+template<typename T, typename Predicate>
+void stablepartitionbuffered(std::vector<T>& list, Predicate test)
+{
+    int capacity = (int)std::max((size_t)16, 4096 / sizeof(T));
+    
+    // largest power of 2 that fits in the buffer, so that the subsets line up with the later cycles
+    int subsetSize = 1;
+    while (subsetSize*2 <= capacity)
+        subsetSize *= 2;
+    
+    std::vector<T> buffer;
+    buffer.reserve((size_t)capacity);
+    
+    int last = (int)list.size()-1;
+    
+    for (int j = 0; j <= last; j += subsetSize)
+    {
+        int high = std::min(j+subsetSize-1, last);
+        int trueEnd = j;
+        
+        buffer.clear();
+        for (int k = j; k <= high; k++)
+        {
+            if (test(list[k]))
+            {
+                // no self-move while every element so far has been 'true'
+                if (trueEnd != k)
+                    list[trueEnd] = std::move(list[k]);
+                trueEnd++;
+            }
+            else
+                buffer.push_back(std::move(list[k]));
+        }
+        std::move(buffer.begin(), buffer.end(), list.begin() + trueEnd);
+    }
+    
+    // the rest of the cycles, as in 'stablepartition'
+    for (int i = 2*subsetSize; i < 2*(last+1); i *= 2)
+    {
+        for (int j = 0; j < last; j += i)
+        {
+            int middle = j+i/2;
+            int high = std::min(j+i-1, last);
+            
+            if (middle <= high && !test(list[middle-1]) && test(list[middle]))
+                bufferedmerge(list, test, j, middle, high, buffer);
+        }
+    }
+}
+
+// 'merge', rotating the window through the buffer when its smaller side fits
+template<typename T, typename Predicate>
+void bufferedmerge(std::vector<T>& list, Predicate test, int low, int middle, int high, std::vector<T>& buffer)
+{
+    int correctBeforeHere = gallopingpartitionpoint(list, test, low, middle-1, middle-1);
+    int correctFromHere = gallopingpartitionpoint(list, test, middle, high, middle);
+    
+    int falses = middle - correctBeforeHere;
+    int trues = correctFromHere - middle;
+    typename std::vector<T>::iterator begin = list.begin();
+    
+    buffer.clear();
+    if (falses <= (int)buffer.capacity() && falses <= trues)
+    {
+        // falses out, trues down, falses back in after them
+        buffer.insert(buffer.end(), std::make_move_iterator(begin + correctBeforeHere), std::make_move_iterator(begin + middle));
+        std::move(begin + middle, begin + correctFromHere, begin + correctBeforeHere);
+        std::move(buffer.begin(), buffer.end(), begin + correctBeforeHere + trues);
+    }
+    else if (trues <= (int)buffer.capacity())
+    {
+        // trues out, falses up, trues back in before them
+        buffer.insert(buffer.end(), std::make_move_iterator(begin + middle), std::make_move_iterator(begin + correctFromHere));
+        std::move_backward(begin + correctBeforeHere, begin + middle, begin + correctFromHere);
+        std::move(buffer.begin(), buffer.end(), begin + correctBeforeHere);
+    }
+    else
+        rotate(list, correctBeforeHere, middle, correctFromHere-1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Partitioning with a per-block purity summary, for data where 'true' and 'false' elements come in long clusters.
+// The list is split into blocks of 2^blockShift elements (64 by default) and a 2-bit summary is kept per block
+// recording whether it is all 'true', all 'false' or mixed, which costs 1 byte per 256 elements.
+
+// Each block is scanned first, and only partitioned on its own if it turns out to be mixed; on clustered data nearly
+// every block is pure, so this is one call to the boolean function per element, against about 1.5 per element for
+// 'stablepartition', which tests elements again in the merges of its first cycles. From then on the summary is
+// kept exact as merges run, and the cycles read only the summary: both halves of a subset are partitioned, so a
+// mixed block at the end of the first half must end in a 'false' element and a mixed block at the start of the
+// second half must start with a 'true' one. Subsets that need no merge are skipped without touching the list or
+// calling the boolean function, and merges find their window by walking the summary, only searching inside the one
+// mixed block at each end.
+template<typename T, typename Predicate>
+void stablepartitionclustered(std::vector<T>& list, Predicate test, int blockShift)
+{
+    int blockSize = 1 << blockShift;
+    int last = (int)list.size()-1;
+    
+    PuritySummary summary;
+    summary.blockShift = blockShift;
+    summary.bits.assign((size_t)(((last >> blockShift) + 1 + 3) / 4), 0);
+    
+    for (int j = 0; j <= last; j += blockSize)
+    {
+        int high = std::min(j+blockSize-1, last);
+        
+        // scan for the first element that differs from the first one, and leave the block alone if there is none
+        bool first = test(list[j]);
+        int k = j+1;
+        while (k <= high && test(list[k]) == first)
+            k++;
+        
+        if (k > high)
+        {
+            summary.set(j >> blockShift, first ? TRUE_BLOCK : FALSE_BLOCK);
+            continue;
+        }
+        
+        // a leading run of 'true' elements is already in place, so only the rest of the block needs partitioning
+        stablepartition(list, test, first ? k : j, high);
+        summary.set(j >> blockShift, MIXED_BLOCK);
+    }
+    
+    // the rest of the cycles, as in 'stablepartition', with every subset a whole number of blocks
+    for (int i = 2*blockSize; i < 2*(last+1); i *= 2)
+    {
+        for (int j = 0; j < last; j += i)
+        {
+            int middle = j+i/2;
+            int high = std::min(j+i-1, last);
+            
+            if (middle <= high && summary.get((middle-1) >> blockShift) != TRUE_BLOCK
+                               && summary.get(middle >> blockShift) != FALSE_BLOCK)
+                summarizedmerge(list, test, summary, j, middle, high);
+        }
+    }
+}
+
+// 'merge' for block-aligned subsets, finding the window from the summary and updating the summary for the blocks
+// it rearranges
+template<typename T, typename Predicate>
+void summarizedmerge(std::vector<T>& list, Predicate test, PuritySummary& summary, int low, int middle, int high)
+{
+    int shift = summary.blockShift;
+    
+    // walk back over the 'false' blocks of the first half
+    int block = (middle-1) >> shift;
+    while (block > (low >> shift) && summary.get(block) == FALSE_BLOCK)
+        block--;
+    
+    int correctBeforeHere;
+    if (summary.get(block) == TRUE_BLOCK)
+        correctBeforeHere = (block+1) << shift;
+    else if (summary.get(block) == FALSE_BLOCK)
+        correctBeforeHere = low;
+    else
+        correctBeforeHere = partitionpoint(list, test, block << shift, ((block+1) << shift) - 1);
+    
+    // walk forward over the 'true' blocks of the second half
+    block = middle >> shift;
+    while (block < (high >> shift) && summary.get(block) == TRUE_BLOCK)
+        block++;
+    
+    int correctFromHere;
+    if (summary.get(block) == FALSE_BLOCK)
+        correctFromHere = block << shift;
+    else if (summary.get(block) == TRUE_BLOCK)
+        correctFromHere = high+1;
+    else
+        correctFromHere = partitionpoint(list, test, block << shift, std::min(((block+1) << shift) - 1, high));
+    
+    rotate(list, correctBeforeHere, middle, correctFromHere-1);
+    
+    // the window now holds its 'true' elements followed by its 'false' ones, and elements before the window are
+    // 'true' and after it 'false', so each block it touches can be summarized from where the new boundary falls
+    int boundary = correctBeforeHere + (correctFromHere - middle);
+    for (block = correctBeforeHere >> shift; block <= (correctFromHere-1) >> shift; block++)
+    {
+        int blockLow = block << shift;
+        int blockHigh = std::min(((block+1) << shift) - 1, (int)list.size()-1);
+        
+        if (blockHigh < boundary)
+            summary.set(block, TRUE_BLOCK);
+        else if (blockLow >= boundary)
+            summary.set(block, FALSE_BLOCK);
+        else
+            summary.set(block, MIXED_BLOCK);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Partitioning with as few writes as possible, for lists where writing is what costs (mapped files on SSDs or
+// persistent memory, where every dirtied page has to be written back). The merges of 'stablepartition' can move an
+// element once per cycle, O(log n) times in all; here every element is written at most once, straight into its final
+// place, and elements already in place are not written at all.
+
+// Each element is tested once, recording the results in a bitmap along with the number of 'true' elements before each
+// 64-bit word of it, from which any element's final index follows in O(1). The permutation is then applied one cycle
+// at a time: the first element of a cycle is held aside, and each element it displaces is carried on to its own final
+// place until the cycle closes. The bitmaps and ranks take about a third of a byte per element, so this is not O(1)
+// memory overhead. Returns the partition point.
+template<typename T, typename Predicate>
+int stablepartitionwriteonce(std::vector<T>& list, Predicate test)
+{
+    int size = (int)list.size();
+    int words = (size+63)/64;
+    
+    std::vector<uint64_t> selected((size_t)words, 0);
+    for (int i = 0; i < size; i++)
+    {
+        if (test(list[i]))
+            selected[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+    
+    // ranks[w] is the number of 'true' elements before word w
+    std::vector<int> ranks((size_t)words+1, 0);
+    for (int w = 0; w < words; w++)
+        ranks[w+1] = ranks[w] + __builtin_popcountll(selected[w]);
+    int trues = ranks[words];
+    
+    std::vector<uint64_t> placed((size_t)words, 0);
+    for (int start = 0; start < size; start++)
+    {
+        if (placed[start >> 6] & ((uint64_t)1 << (start & 63)))
+            continue;
+        
+        int to = partitionedPosition(selected, ranks, trues, start);
+        if (to == start)
+            continue;
+        
+        // 'held' is always the element whose final index is 'to': the one originally at 'start' the first time round,
+        // and after that the one originally at the previous value of 'to'
+        T held = std::move(list[start]);
+        while (true)
+        {
+            placed[to >> 6] |= (uint64_t)1 << (to & 63);
+            if (to == start)
+            {
+                list[start] = std::move(held);
+                break;
+            }
+            std::swap(held, list[to]);
+            to = partitionedPosition(selected, ranks, trues, to);
+        }
+    }
+    
+    return trues;
+}
+
+// Final index of the element at index i, given the bitmap of 'true' elements and its ranks
+int partitionedPosition(const std::vector<uint64_t>& selected, const std::vector<int>& ranks, int trues, int i)
+{
+    uint64_t word = selected[i >> 6];
+    uint64_t bit = (uint64_t)1 << (i & 63);
+    int truesBefore = ranks[i >> 6] + __builtin_popcountll(word & (bit-1));
+    
+    if (word & bit)
+        return truesBefore;
+    return trues + (i - truesBefore);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Undoing a stable partition: given a stably partitioned list and which of its elements were originally 'true', puts
+// every element back at its original index, so the original order need not be kept in a copy. The selection is a
+// bitmap, bit i of word i/64 being set if the element originally at index i was 'true'.
+
+// Records the outcome of 'test' for every element of list as a selection bitmap, to be taken before partitioning
+template<typename T, typename Predicate>
+void makeSelection(const std::vector<T>& list, Predicate test, std::vector<uint64_t>& selected)
+{
+    selected.assign((list.size()+63)/64, 0);
+    for (size_t i = 0; i < list.size(); i++)
+    {
+        if (test(list[i]))
+            selected[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+}
+
+// In place, with O(1) memory overhead: 'stablepartition' run backwards. Working down from the largest cycle, each
+// subset is partitioned and the selection says how many of its 'true' and 'false' elements came from each half, so
+// one rotation exchanging the second half's 'true' elements with the first half's 'false' elements leaves both halves
+// partitioned, ready for the next cycle down. After the cycle of size 2 every element is back in place. O(n log n)
+// moves, and the counts take O(n/64) popcounts per cycle.
+template<typename T>
+void stableunpartition(std::vector<T>& list, const std::vector<uint64_t>& selected)
+{
+    int last = (int)list.size()-1;
+    
+    int top = 2;
+    while (top < last+1)
+        top *= 2;
+    
+    for (int i = top; i >= 2; i /= 2)
+    {
+        for (int j = 0; j < last; j += i)
+        {
+            int middle = j+i/2;
+            int high = std::min(j+i-1, last);
+            if (middle > high)
+                continue;
+            
+            int firstTrues = countSelected(selected, j, middle-1);
+            int firstFalses = middle-j - firstTrues;
+            int secondTrues = countSelected(selected, middle, high);
+            
+            rotate(list, j+firstTrues, j+firstTrues+secondTrues, j+firstTrues+secondTrues+firstFalses-1);
+        }
+    }
+}
+
+// Same as above, with the original outcomes of the boolean function given one per element
+template<typename T>
+void stableunpartition(std::vector<T>& list, const std::vector<bool>& outcomes)
+{
+    std::vector<uint64_t> selected((outcomes.size()+63)/64, 0);
+    for (size_t i = 0; i < outcomes.size(); i++)
+    {
+        if (outcomes[i])
+            selected[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+    stableunpartition(list, selected);
+}
+
+// Through a buffer the size of the list, on 'threads' threads, in O(n) time. Each thread fills an equal range of the
+// buffer in original order, taking elements from the 'true' and 'false' sections of the list as the selection
+// says, starting from the number of each that come before its range. The buffer is then moved back, also in parallel.
+template<typename T>
+void stableunpartitionparallel(std::vector<T>& list, const std::vector<uint64_t>& selected, int threads)
+{
+    int size = (int)list.size();
+    int shards = std::max(1, std::min(threads, size));
+    int trues = size > 0 ? countSelected(selected, 0, size-1) : 0;
+    
+    std::vector<T> buffer(list.size());
+    std::vector<std::thread> workers;
+    for (int s = 0; s < shards; s++)
+    {
+        int first = (int)((long long)size * s / shards);
+        int end = (int)((long long)size * (s+1) / shards);
+        
+        workers.push_back(std::thread([=, &list, &selected, &buffer]()
+        {
+            int nextTrue = first > 0 ? countSelected(selected, 0, first-1) : 0;
+            int nextFalse = trues + first - nextTrue;
+            
+            for (int i = first; i < end; i++)
+            {
+                if (selected[i >> 6] & ((uint64_t)1 << (i & 63)))
+                    buffer[i] = std::move(list[nextTrue++]);
+                else
+                    buffer[i] = std::move(list[nextFalse++]);
+            }
+        }));
+    }
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+    
+    workers.clear();
+    for (int s = 0; s < shards; s++)
+    {
+        int first = (int)((long long)size * s / shards);
+        int end = (int)((long long)size * (s+1) / shards);
+        
+        workers.push_back(std::thread([=, &list, &buffer]()
+            { std::move(buffer.begin() + first, buffer.begin() + end, list.begin() + first); }));
+    }
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+}
+
+// Number of set bits of a selection bitmap from index low to index high (inclusive)
+int countSelected(const std::vector<uint64_t>& selected, int low, int high)
+{
+    int firstWord = low >> 6;
+    int lastWord = high >> 6;
+    uint64_t firstMask = ~(uint64_t)0 << (low & 63);
+    uint64_t lastMask = ~(uint64_t)0 >> (63 - (high & 63));
+    
+    if (firstWord == lastWord)
+        return __builtin_popcountll(selected[firstWord] & firstMask & lastMask);
+    
+    int count = __builtin_popcountll(selected[firstWord] & firstMask) + __builtin_popcountll(selected[lastWord] & lastMask);
+    for (int w = firstWord+1; w < lastWord; w++)
+        count += __builtin_popcountll(selected[w]);
+    return count;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Partitioning by a given selection instead of a boolean function, for when which elements are 'true' is already
+// known, e.g. from an earlier vectorized filter. The selection is either a bitmap as for 'stableunpartition' or a
+// sorted list of the indexes of the 'true' elements. The boolean function is never called. Each returns the partition
+// point.
+
+// Partitions by a selection bitmap
+template<typename T>
+int stablepartition(std::vector<T>& list, const std::vector<uint64_t>& selected)
+{
+    BitmapCount count = { &selected };
+    return selectedpartition(list, count);
+}
+
+// Partitions by a sorted list of the indexes of the 'true' elements
+template<typename T>
+int stablepartition(std::vector<T>& list, const std::vector<int>& indices)
+{
+    IndexCount count = { &indices };
+    return selectedpartition(list, count);
+}
+
+// The cycles of 'stablepartition', except that an element's original index is all that says whether it is 'true',
+// and elements move, so instead of testing elements each merge asks 'count' how many of each half's elements were
+// selected. A half that has been partitioned holds that many 'true' elements followed by the rest, so the window to
+// rotate is known without any searching. This is 'stableunpartition' run forwards: O(n log n) moves, O(1) memory.
+template<typename T, typename Count>
+int selectedpartition(std::vector<T>& list, Count count)
+{
+    int last = (int)list.size()-1;
+    if (last < 0)
+        return 0;
+    
+    for (int i = 2; i < 2*(last+1); i *= 2)
+    {
+        for (int j = 0; j < last; j += i)
+        {
+            int middle = j+i/2;
+            int high = std::min(j+i-1, last);
+            if (middle > high)
+                continue;
+            
+            int firstTrues = count(j, middle-1);
+            int secondTrues = count(middle, high);
+            
+            rotate(list, j+firstTrues, middle, middle+secondTrues-1);
+        }
+    }
+    
+    return count(0, last);
+}
+
+// O(n) partition of ints by a selection bitmap, using the vector compaction kernels of the command line tool (see
+// 'compactInts'). Works through the list in blocks, expanding each block's bits to flags, copying its 'false'
+// elements out to a buffer and then compacting its 'true' elements down in place after the previous blocks' ones.
+// The buffer is the only extra memory, up to the size of the list.
+int stablepartitioncompact(std::vector<int>& list, const std::vector<uint64_t>& selected)
+{
+    const int block = 4096;
+    bool flags[block];
+    
+    int size = (int)list.size();
+    std::vector<int> falses((size_t)size);
+    int trueEnd = 0, falseEnd = 0;
+    
+    for (int start = 0; start < size; start += block)
+    {
+        int n = std::min(block, size - start);
+        for (int i = 0; i < n; i++)
+            flags[i] = (selected[(start+i) >> 6] >> ((start+i) & 63)) & 1;
+        
+        // the 'false' elements first, since compacting the 'true' ones may overwrite the start of the block
+        falseEnd += compactInts(&list[start], flags, n, false, &falses[falseEnd]);
+        trueEnd += compactInts(&list[start], flags, n, true, &list[trueEnd]);
+    }
+    
+    std::copy(falses.begin(), falses.begin() + falseEnd, list.begin() + trueEnd);
+    return trueEnd;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Partitioning with weaker ordering guarantees. When only one section needs to stay in order, or neither does, a
+// single O(n) pass of swaps is enough, much faster than the O(n log n) 'stablepartition'. Switching between them is
+// just a change of the 'stability' argument.
+
+// Partitions the list with the requested ordering guarantee, and returns the index of the first 'false' element
+// (or the size of the list if there are none)
+template<typename T, typename Predicate>
+int stablepartition(std::vector<T>& list, Predicate test, Stability stability)
+{
+    if (stability == UNSTABLE)
+        return unstablepartition(list, test);
+    if (stability != STABLE)
+        return semistablepartition(list, test, stability);
+    
+    stablepartition(list, test);
+    return partitionpoint(list, test);
+}
+
+// One pass partition keeping one section stable. For STABLE_TRUES, each 'true' element is swapped down to the end of
+// the 'true' elements found so far, so they stay in order while the 'false' elements they are swapped with get
+// shuffled. STABLE_FALSES is the mirror image, working down from the end of the list. Each element is tested once.
+template<typename T, typename Predicate>
+int semistablepartition(std::vector<T>& list, Predicate test, Stability stability)
+{
+    int size = (int)list.size();
+    
+    if (stability == STABLE_FALSES)
+    {
+        int falseStart = size;
+        for (int i = size-1; i >= 0; i--)
+        {
+            if (!test(list[i]))
+            {
+                falseStart--;
+                if (i != falseStart)
+                    swap(list, i, falseStart);
+            }
+        }
+        return falseStart;
+    }
+    
+    int trueEnd = 0;
+    for (int i = 0; i < size; i++)
+    {
+        if (test(list[i]))
+        {
+            if (i != trueEnd)
+                swap(list, i, trueEnd);
+            trueEnd++;
+        }
+    }
+    return trueEnd;
+}
+
+// Unstable partition in the style of BlockQuicksort's partitioning. Works inwards from both ends a block of
+// elements at a time: first the offsets of the misplaced elements of a block ('false' ones on the left, 'true' ones
+// on the right) are recorded without any branches on the test results, then the recorded elements are swapped in
+// pairs. Keeping the tests and the data dependent swaps apart avoids the branch mispredictions that make an
+// ordinary Hoare partition slow on unpredictable data. Each element is tested about once.
+template<typename T, typename Predicate>
+int unstablepartition(std::vector<T>& list, Predicate test)
+{
+    const int block = 64;
+    unsigned char offsetsLeft[block];
+    unsigned char offsetsRight[block];
+    
+    // everything before 'left' is 'true' and everything from 'right' on is 'false'
+    int left = 0;
+    int right = (int)list.size();
+    int startLeft = 0, countLeft = 0;
+    int startRight = 0, countRight = 0;
+    
+    while (right - left > 2*block)
+    {
+        if (countLeft == 0)
+        {
+            startLeft = 0;
+            for (int i = 0; i < block; i++)
+            {
+                offsetsLeft[countLeft] = (unsigned char)i;
+                countLeft += !test(list[left+i]);
+            }
+        }
+        if (countRight == 0)
+        {
+            startRight = 0;
+            for (int i = 0; i < block; i++)
+            {
+                offsetsRight[countRight] = (unsigned char)i;
+                countRight += test(list[right-1-i]) ? 1 : 0;
+            }
+        }
+        
+        int pairs = std::min(countLeft, countRight);
+        for (int k = 0; k < pairs; k++)
+            swap(list, left + offsetsLeft[startLeft+k], right-1 - offsetsRight[startRight+k]);
+        
+        countLeft -= pairs;
+        countRight -= pairs;
+        startLeft += pairs;
+        startRight += pairs;
+        
+        // a block with no misplaced elements left is done
+        if (countLeft == 0)
+            left += block;
+        if (countRight == 0)
+            right -= block;
+    }
+    
+    // finish the few blocks' worth of elements in the middle with a plain Hoare partition
+    while (true)
+    {
+        while (left < right && test(list[left]))
+            left++;
+        while (left < right && !test(list[right-1]))
+            right--;
+        if (left == right)
+            return left;
+        swap(list, left, right-1);
+        left++;
+        right--;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Returns a pointer to the first occurrence of c in [begin, end), or end if there is none. Compares 64 bytes per
+// iteration with SSE2 (or NEON) where available, or 32 at a time with AVX2; the tail, the scalar backend, and
+// platforms without any of them use a plain byte loop.
+const char* findByte(const char* begin, const char* end, char c)
+{
+#if defined(HAVE_X86_DISPATCH)
+    if (simdBackend() >= SIMD_AVX2 && simdBackend() <= SIMD_AVX512)
+        return findByteAvx2(begin, end, c);
+#endif
+#if defined(__SSE2__)
+    if (simdBackend() != SIMD_SCALAR)
+    {
+        __m128i pattern = _mm_set1_epi8(c);
+        while (end - begin >= 64)
+        {
+            __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)begin), pattern);
+            __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(begin+16)), pattern);
+            __m128i c2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(begin+32)), pattern);
+            __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(begin+48)), pattern);
+            
+            // cheap test for the common case of no match anywhere in the 64 bytes
+            if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c2, d))) != 0)
+                break;
+            begin += 64;
+        }
+        while (end - begin >= 16)
+        {
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)begin), pattern));
+            if (mask != 0)
+                return begin + __builtin_ctz(mask);
+            begin += 16;
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (simdBackend() != SIMD_SCALAR)
+    {
+        uint8x16_t pattern = vdupq_n_u8((uint8_t)c);
+        while (end - begin >= 16)
+        {
+            uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t*)begin), pattern);
+            // narrow each byte of the comparison to 4 bits, giving a 64-bit mask with 4 bits per input byte
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            if (mask != 0)
+                return begin + (__builtin_ctzll(mask) >> 2);
+            begin += 16;
+        }
+    }
+#endif
+    while (begin < end && *begin != c)
+        begin++;
+    return begin;
+}
+
+// Splits the input into one record per line. A trailing '\r' is dropped from each line so that files with Windows
+// line endings partition the same way, and a final line without a newline is still included.
+void splitLines(const char* data, size_t size, std::vector<Record>& records)
+{
+    const char* end = data + size;
+    const char* lineStart = data;
+    
+    while (lineStart < end)
+    {
+        const char* lineEnd = findByte(lineStart, end, '\n');
+        
+        Record r;
+        r.data = lineStart;
+        r.length = (size_t)(lineEnd - lineStart);
+        r.selected = false;
+        if (r.length > 0 && r.data[r.length-1] == '\r')
+            r.length--;
+        records.push_back(r);
+        
+        lineStart = lineEnd + 1;
+    }
+}
+
+// Returns the given (0-based) delimited field of a line, or an empty record if the line has fewer fields.
+Record fieldOf(const Record& line, int column, char delimiter)
+{
+    const char* begin = line.data;
+    const char* end = line.data + line.length;
+    
+    for (int i = 0; i < column && begin < end; i++)
+        begin = findByte(begin, end, delimiter) + 1;
+    
+    Record field;
+    field.data = begin < end ? begin : end;
+    field.length = (size_t)(findByte(field.data, end, delimiter) - field.data);
+    field.selected = false;
+    return field;
+}
+
+// Parses a (possibly signed) decimal int from the start of a record, skipping leading spaces, like atoi but
+// without needing a null terminated copy of the text. Values out of range clamp to INT_MAX or INT_MIN.
+int parseInt(const Record& r)
+{
+    const char* p = r.data;
+    const char* end = r.data + r.length;
+    while (p < end && *p == ' ')
+        p++;
+    
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+    
+    // accumulate the magnitude in a wider type, stopping at the largest magnitude an int can take
+    const long long limit = negative ? -(long long)INT_MIN : (long long)INT_MAX;
+    long long value = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        value = value*10 + (*p++ - '0');
+        if (value > limit)
+            value = limit;
+    }
+    return (int)(negative ? -value : value);
+}
+
+// Boolean function for passing to stablepartition once each record's 'selected' flag has been filled in
+bool recordSelected(Record r)
+{
+    return r.selected;
+}
+
+// Reads everything from a pipe, FIFO or terminal, whose size fstat cannot report, into an anonymous mapping so
+// that the result can be released by 'unmapInputFile' just like a mapped file. Closes fd.
+static const char* readInputStream(int fd, size_t& size)
+{
+    static const char empty = 0;
+    
+    std::vector<char> buffer;
+    char block[1 << 16];
+    for (;;)
+    {
+        ssize_t count = read(fd, block, sizeof(block));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+        {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return NULL;
+        }
+        if (count == 0)
+            break;
+        buffer.insert(buffer.end(), block, block + count);
+    }
+    close(fd);
+    
+    size = buffer.size();
+    if (size == 0)
+        return &empty;
+    
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+    memcpy(data, &buffer[0], size);
+    mprotect(data, size, PROT_READ);
+    return (const char*)data;
+}
+
+// Maps a whole file read-only into memory. Returns NULL on failure; an empty file is returned as a non-NULL
+// pointer with a size of 0, since mmap itself does not accept empty mappings. Pipes and other non-regular
+// files have no size to map, so they are read to the end instead.
+const char* mapInputFile(const char* path, size_t& size)
+{
+    static const char empty = 0;
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    if (!S_ISREG(info.st_mode))
+        return readInputStream(fd, size);
+    
+    size = (size_t)info.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        return &empty;
+    }
+    
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+    
+    // the input is only ever read front to back, once when splitting and once more when writing out
+    madvise(data, size, MADV_SEQUENTIAL);
+    return (const char*)data;
+}
+
+void unmapInputFile(const char* data, size_t size)
+{
+    if (size > 0)
+        munmap((void*)data, size);
+}
+
+// Writes records [begin, end) to fd, one per line. Records are gathered into a large buffer so that each write
+// call moves a big block rather than one short line.
+bool writeRecords(int fd, const std::vector<Record>& records, int begin, int end)
+{
+    const size_t capacity = 1 << 20;
+    std::vector<char> buffer;
+    buffer.reserve(capacity);
+    
+    for (int i = begin; i <= end; i++)
+    {
+        // flush when the next line will not fit, or at the end
+        if (i == end || buffer.size() + records[i].length + 1 > capacity)
+        {
+            if (!buffer.empty() && !writeAll(fd, &buffer[0], buffer.size()))
+                return false;
+            buffer.clear();
+            if (i == end)
+                break;
+        }
+        
+        // lines longer than the buffer are written directly
+        if (records[i].length + 1 > capacity)
+        {
+            if (!writeAll(fd, records[i].data, records[i].length) || !writeAll(fd, "\n", 1))
+                return false;
+            continue;
+        }
+        
+        buffer.insert(buffer.end(), records[i].data, records[i].data + records[i].length);
+        buffer.push_back('\n');
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Lanes backends. Each provides a vector type of 'width' ints and the operations the kernels need. Comparisons give
+// 1 or 0 in each lane, matching the C++ results, rather than the all-ones masks of the hardware instructions.
+// 'compact' stores the lanes whose bit is set in 'mask' contiguously at out, in order, and returns how many were
+// stored (it may write a whole vector at out regardless).
+
+// Plain C++ lanes, which any compiler can build and vectorize as well as it is able
+
+template<int Width>
+struct ArrayLanes
+{
+    struct vector { int v[Width]; };
+    static const int width = Width;
+    
+    static vector load(const int* p) { vector r; memcpy(r.v, p, sizeof(r.v)); return r; }
+    static void store(int* p, const vector& a) { memcpy(p, a.v, sizeof(a.v)); }
+    static vector splat(int x) { vector r; for (int i = 0; i < Width; i++) r.v[i] = x; return r; }
+    
+    static vector add(vector a, const vector& b) { for (int i = 0; i < Width; i++) a.v[i] = (int)((unsigned)a.v[i] + (unsigned)b.v[i]); return a; }
+    static vector sub(vector a, const vector& b) { for (int i = 0; i < Width; i++) a.v[i] = (int)((unsigned)a.v[i] - (unsigned)b.v[i]); return a; }
+    static vector mul(vector a, const vector& b) { for (int i = 0; i < Width; i++) a.v[i] = (int)((unsigned)a.v[i] * (unsigned)b.v[i]); return a; }
+    static vector bitAnd(vector a, const vector& b) { for (int i = 0; i < Width; i++) a.v[i] &= b.v[i]; return a; }
+    static vector equal(vector a, const vector& b) { for (int i = 0; i < Width; i++) a.v[i] = a.v[i] == b.v[i]; return a; }
+    static vector less(vector a, const vector& b) { for (int i = 0; i < Width; i++) a.v[i] = a.v[i] < b.v[i]; return a; }
+    static vector greater(vector a, const vector& b) { for (int i = 0; i < Width; i++) a.v[i] = a.v[i] > b.v[i]; return a; }
+    
+    static int compact(const vector& a, int mask, int* out)
+    {
+        // branchless: always store, only advance past lanes that are kept
+        int k = 0;
+        for (int i = 0; i < Width; i++)
+        {
+            out[k] = a.v[i];
+            k += (mask >> i) & 1;
+        }
+        return k;
+    }
+};
+
+// The plain C++ backend
+typedef ArrayLanes<4> ScalarLanes;
+
+#if defined(__SSSE3__) || defined(HAVE_X86_DISPATCH) || (defined(__ARM_NEON) && defined(__aarch64__))
+// Byte shuffles that move the selected 4-byte lanes of a 16 byte vector to the front, indexed by lane mask
+struct CompactShuffleTable
+{
+    unsigned char bytes[16][16];
+    
+    CompactShuffleTable()
+    {
+        for (int mask = 0; mask < 16; mask++)
+        {
+            int k = 0;
+            for (int lane = 0; lane < 4; lane++)
+            {
+                if (mask & (1 << lane))
+                {
+                    for (int byte = 0; byte < 4; byte++)
+                        bytes[mask][4*k + byte] = (unsigned char)(4*lane + byte);
+                    k++;
+                }
+            }
+            for (; k < 4; k++)
+                for (int byte = 0; byte < 4; byte++)
+                    bytes[mask][4*k + byte] = 0x80;
+        }
+    }
+};
+
+static const CompactShuffleTable compactShuffleTable;
+
+static const unsigned char* compactShuffles()
+{
+    return &compactShuffleTable.bytes[0][0];
+}
+#endif
+
+#if defined(__SSE2__)
+struct SseLanes
+{
+    typedef __m128i vector;
+    static const int width = 4;
+    
+    static vector load(const int* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void store(int* p, vector a) { _mm_storeu_si128((__m128i*)p, a); }
+    static vector splat(int x) { return _mm_set1_epi32(x); }
+    
+    static vector add(vector a, vector b) { return _mm_add_epi32(a, b); }
+    static vector sub(vector a, vector b) { return _mm_sub_epi32(a, b); }
+    static vector bitAnd(vector a, vector b) { return _mm_and_si128(a, b); }
+    static vector equal(vector a, vector b) { return _mm_srli_epi32(_mm_cmpeq_epi32(a, b), 31); }
+    static vector less(vector a, vector b) { return _mm_srli_epi32(_mm_cmplt_epi32(a, b), 31); }
+    static vector greater(vector a, vector b) { return _mm_srli_epi32(_mm_cmpgt_epi32(a, b), 31); }
+    
+    static vector mul(vector a, vector b)
+    {
+#if defined(__SSE4_1__)
+        return _mm_mullo_epi32(a, b);
+#else
+        // SSE2 only multiplies lanes 0 and 2; do the odd lanes separately and interleave the low halves
+        __m128i even = _mm_mul_epu32(a, b);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+    }
+    
+    static int compact(vector a, int mask, int* out)
+    {
+#if defined(__SSSE3__)
+        __m128i shuffle = _mm_loadu_si128((const __m128i*)(compactShuffles() + 16*mask));
+        _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(a, shuffle));
+        return __builtin_popcount(mask);
+#else
+        ScalarLanes::vector lanes;
+        _mm_storeu_si128((__m128i*)lanes.v, a);
+        return ScalarLanes::compact(lanes, mask, out);
+#endif
+    }
+};
+#endif
+
+#if defined(__ARM_NEON)
+struct NeonLanes
+{
+    typedef int32x4_t vector;
+    static const int width = 4;
+    
+    static vector load(const int* p) { return vld1q_s32(p); }
+    static void store(int* p, vector a) { vst1q_s32(p, a); }
+    static vector splat(int x) { return vdupq_n_s32(x); }
+    
+    static vector add(vector a, vector b) { return vaddq_s32(a, b); }
+    static vector sub(vector a, vector b) { return vsubq_s32(a, b); }
+    static vector mul(vector a, vector b) { return vmulq_s32(a, b); }
+    static vector bitAnd(vector a, vector b) { return vandq_s32(a, b); }
+    static vector equal(vector a, vector b) { return vreinterpretq_s32_u32(vshrq_n_u32(vceqq_s32(a, b), 31)); }
+    static vector less(vector a, vector b) { return vreinterpretq_s32_u32(vshrq_n_u32(vcltq_s32(a, b), 31)); }
+    static vector greater(vector a, vector b) { return vreinterpretq_s32_u32(vshrq_n_u32(vcgtq_s32(a, b), 31)); }
+    
+    static int compact(vector a, int mask, int* out)
+    {
+#if defined(__aarch64__)
+        uint8x16_t shuffle = vld1q_u8(compactShuffles() + 16*mask);
+        vst1q_s32(out, vreinterpretq_s32_u8(vqtbl1q_u8(vreinterpretq_u8_s32(a), shuffle)));
+        return __builtin_popcount(mask);
+#else
+        ScalarLanes::vector lanes;
+        vst1q_s32(lanes.v, a);
+        return ScalarLanes::compact(lanes, mask, out);
+#endif
+    }
+};
+#endif
+
+#if defined(HAVE_X86_DISPATCH)
+// Kernels for x86 instruction sets beyond what the build targets. Each is compiled for its instruction set with a
+// target attribute and only ever called after 'bestSimdBackend' has checked that the CPU supports it, so a single
+// binary runs on any x86 machine and still uses the widest vectors available.
+
+// The wider backends reuse the plain C++ lanes with 8 or 16 lanes. Their fixed size loops turn into single vector
+// instructions once they are inlined into a function compiled for the instruction set, which is why the kernels
+// below are 'flatten'ed wrappers with a target attribute.
+__attribute__((target("sse4.2"), flatten))
+static void evaluateExpressionSse42(const Expression& expr, const int* const* columns, int count, bool* results)
+{
+    evaluateExpression< ArrayLanes<4> >(expr, columns, count, results);
+}
+
+__attribute__((target("avx2"), flatten))
+static void evaluateExpressionAvx2(const Expression& expr, const int* const* columns, int count, bool* results)
+{
+    evaluateExpression< ArrayLanes<8> >(expr, columns, count, results);
+}
+
+__attribute__((target("avx512f"), flatten))
+static void evaluateExpressionAvx512(const Expression& expr, const int* const* columns, int count, bool* results)
+{
+    evaluateExpression< ArrayLanes<16> >(expr, columns, count, results);
+}
+
+// Lane permutations that move the selected lanes of an 8 x int vector to the front, indexed by lane mask
+struct CompactPermuteTable
+{
+    unsigned char lanes[256][8];
+    
+    CompactPermuteTable()
+    {
+        for (int mask = 0; mask < 256; mask++)
+        {
+            int k = 0;
+            for (int lane = 0; lane < 8; lane++)
+                if (mask & (1 << lane))
+                    lanes[mask][k++] = (unsigned char)lane;
+            for (; k < 8; k++)
+                lanes[mask][k] = 0;
+        }
+    }
+};
+
+static const CompactPermuteTable compactPermuteTable;
+
+// Remainder of a compaction after the vector loop of one of the kernels below
+static int compactTail(const int* values, const bool* flags, int count, bool keep, int* out, int i, int k)
+{
+    for (; i < count; i++)
+    {
+        out[k] = values[i];
+        k += flags[i] == keep;
+    }
+    return k;
+}
+
+// The kernels turn 16 (or 8) flag bytes into a lane mask at once by shifting each flag's 1 bit into the byte's top
+// bit, where movemask collects it
+
+__attribute__((target("sse4.2")))
+static int compactIntsSse42(const int* values, const bool* flags, int count, bool keep, int* out)
+{
+    int k = 0;
+    int flip = keep ? 0 : 0xF;
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        int32_t flagBytes;
+        memcpy(&flagBytes, flags + i, 4);
+        int mask = (_mm_movemask_epi8(_mm_slli_epi16(_mm_cvtsi32_si128(flagBytes), 7)) & 0xF) ^ flip;
+        __m128i shuffle = _mm_loadu_si128((const __m128i*)(compactShuffles() + 16*mask));
+        _mm_storeu_si128((__m128i*)(out + k), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(values + i)), shuffle));
+        k += __builtin_popcount(mask);
+    }
+    return compactTail(values, flags, count, keep, out, i, k);
+}
+
+__attribute__((target("avx2")))
+static int compactIntsAvx2(const int* values, const bool* flags, int count, bool keep, int* out)
+{
+    int k = 0;
+    int flip = keep ? 0 : 0xFF;
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        int mask = (_mm_movemask_epi8(_mm_slli_epi16(_mm_loadl_epi64((const __m128i*)(flags + i)), 7)) & 0xFF) ^ flip;
+        __m256i permute = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)compactPermuteTable.lanes[mask]));
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        _mm256_storeu_si256((__m256i*)(out + k), _mm256_permutevar8x32_epi32(v, permute));
+        k += __builtin_popcount(mask);
+    }
+    return compactTail(values, flags, count, keep, out, i, k);
+}
+
+__attribute__((target("avx512f")))
+static int compactIntsAvx512(const int* values, const bool* flags, int count, bool keep, int* out)
+{
+    int k = 0;
+    int flip = keep ? 0 : 0xFFFF;
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_slli_epi16(_mm_loadu_si128((const __m128i*)(flags + i)), 7)) ^ flip;
+        _mm512_mask_compressstoreu_epi32(out + k, (__mmask16)mask, _mm512_loadu_si512(values + i));
+        k += __builtin_popcount(mask);
+    }
+    return compactTail(values, flags, count, keep, out, i, k);
+}
+
+// 'findByte' with 32 bytes per compare instead of 16
+__attribute__((target("avx2")))
+const char* findByteAvx2(const char* begin, const char* end, char c)
+{
+    __m256i pattern = _mm256_set1_epi8(c);
+    while (end - begin >= 32)
+    {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)begin), pattern));
+        if (mask != 0)
+            return begin + __builtin_ctz(mask);
+        begin += 32;
+    }
+    while (begin < end && *begin != c)
+        begin++;
+    return begin;
+}
+#endif
+
+static SimdBackend currentSimdBackend = bestSimdBackend();
+
+// Whether the build and the CPU it is running on support a backend
+bool simdBackendSupported(SimdBackend backend)
+{
+    switch (backend)
+    {
+        case SIMD_SCALAR:
+            return true;
+#if defined(__SSE2__)
+        case SIMD_SSE2:
+            return true;
+#endif
+#if defined(__ARM_NEON)
+        case SIMD_NEON:
+            return true;
+#endif
+#if defined(HAVE_X86_DISPATCH)
+        case SIMD_SSE42:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse4.2");
+        case SIMD_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+        case SIMD_AVX512:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+// The fastest backend supported here. Checked once, at startup, to set the default backend.
+SimdBackend bestSimdBackend()
+{
+    static const SimdBackend order[] = { SIMD_AVX512, SIMD_AVX2, SIMD_SSE42, SIMD_SSE2, SIMD_NEON };
+    for (int i = 0; i < (int)(sizeof(order) / sizeof(order[0])); i++)
+        if (simdBackendSupported(order[i]))
+            return order[i];
+    return SIMD_SCALAR;
+}
+
+SimdBackend simdBackend()
+{
+    return currentSimdBackend;
+}
+
+// Selects the backend used by the vector kernels. Returns false, leaving the backend unchanged, if it is not
+// supported here.
+bool setSimdBackend(SimdBackend backend)
+{
+    if (!simdBackendSupported(backend))
+        return false;
+    currentSimdBackend = backend;
+    return true;
+}
+
+const char* simdBackendName(SimdBackend backend)
+{
+    switch (backend)
+    {
+        case SIMD_SSE2: return "sse2";
+        case SIMD_SSE42: return "sse4.2";
+        case SIMD_AVX2: return "avx2";
+        case SIMD_AVX512: return "avx512";
+        case SIMD_NEON: return "neon";
+        default: return "scalar";
+    }
+}
+
+// Stably copies the values whose flag equals 'keep' to out, returning how many were copied. Stores never run ahead
+// of the values already read, so out may be the same array as values.
+template<typename Lanes>
+int compactInts(const int* values, const bool* flags, int count, bool keep, int* out)
+{
+    int k = 0;
+    int flip = keep ? 0 : 15;
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        int mask = (flags[i] | flags[i+1] << 1 | flags[i+2] << 2 | flags[i+3] << 3) ^ flip;
+        k += Lanes::compact(Lanes::load(values + i), mask, out + k);
+    }
+    for (; i < count; i++)
+    {
+        out[k] = values[i];
+        k += flags[i] == keep;
+    }
+    return k;
+}
+
+int compactInts(const int* values, const bool* flags, int count, bool keep, int* out)
+{
+    switch (currentSimdBackend)
+    {
+#if defined(__SSE2__)
+        case SIMD_SSE2: return compactInts<SseLanes>(values, flags, count, keep, out);
+#endif
+#if defined(HAVE_X86_DISPATCH)
+        case SIMD_SSE42: return compactIntsSse42(values, flags, count, keep, out);
+        case SIMD_AVX2: return compactIntsAvx2(values, flags, count, keep, out);
+        case SIMD_AVX512: return compactIntsAvx512(values, flags, count, keep, out);
+#endif
+#if defined(__ARM_NEON)
+        case SIMD_NEON: return compactInts<NeonLanes>(values, flags, count, keep, out);
+#endif
+        default: return compactInts<ScalarLanes>(values, flags, count, keep, out);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// Recursive descent parser for predicate expressions, emitting stack machine code as it goes. Precedence, from
+// loosest to tightest: ||, &&, comparisons, + and -, * / and %, then unary - and !. Operands are decimal ints,
+// character literals such as 'M', the variables 'x' and 'c', and the shorthands 'isEven' and 'firstHalf', which
+// match the example functions of the same names.
+class ExpressionParser
+{
+public:
+    ExpressionParser(const char* text, Expression& expr) : p(text), expr(expr), depth(0), nesting(0) {}
+    
+    bool parse(std::string& error)
+    {
+        expr.code.clear();
+        expr.maxDepth = 0;
+        
+        if (!parseOr())
+        {
+            error = message;
+            return false;
+        }
+        skipSpaces();
+        if (*p != '\0')
+        {
+            error = std::string("unexpected '") + *p + "'";
+            return false;
+        }
+        return true;
+    }
+    
+private:
+    const char* p;
+    Expression& expr;
+    int depth;
+    int nesting;                        // parentheses and unary operators the parser is currently inside
+    std::string message;
+    
+    // each level of nesting is a level of recursion, so a limit keeps a malformed or hostile expression from
+    // overflowing the stack
+    static const int maxNesting = 256;
+    
+    void skipSpaces()
+    {
+        while (*p == ' ' || *p == '\t')
+            p++;
+    }
+    
+    bool accept(const char* token)
+    {
+        skipSpaces();
+        size_t length = strlen(token);
+        if (strncmp(p, token, length) != 0)
+            return false;
+        p += length;
+        return true;
+    }
+    
+    bool fail(const char* what)
+    {
+        if (message.empty())
+            message = what;
+        return false;
+    }
+    
+    bool nest()
+    {
+        if (++nesting > maxNesting)
+            return fail("expression nested too deeply");
+        return true;
+    }
+    
+    void emit(ExprOp op, int operand)
+    {
+        ExprInstruction instruction;
+        instruction.op = op;
+        instruction.operand = operand;
+        instruction.immediate = false;
+        
+        if (op == OP_LOAD || op == OP_CONST)
+        {
+            depth++;
+            if (depth > expr.maxDepth)
+                expr.maxDepth = depth;
+        }
+        // binary operator whose right hand side was just pushed as a constant: fold it into the instruction
+        else if (op != OP_NEG && op != OP_NOT && expr.code.back().op == OP_CONST)
+        {
+            instruction.operand = expr.code.back().operand;
+            instruction.immediate = true;
+            expr.code.pop_back();
+            
+            // remainder by a positive power of two needs no division
+            if (op == OP_MOD && instruction.operand > 0 && (instruction.operand & (instruction.operand-1)) == 0)
+                instruction.op = OP_MODPOW2;
+        }
+        
+        if (op != OP_LOAD && op != OP_CONST && op != OP_NEG && op != OP_NOT)
+            depth--;
+        
+        expr.code.push_back(instruction);
+    }
+    
+    // parses the text of a shorthand name as if it had been written out in full
+    bool parseShorthand(const char* text)
+    {
+        const char* saved = p;
+        p = text;
+        bool ok = parseOr();
+        p = saved;
+        return ok;
+    }
+    
+    bool parseOr()
+    {
+        if (!parseAnd())
+            return false;
+        while (accept("||"))
+        {
+            if (!parseAnd())
+                return false;
+            emit(OP_OR, 0);
+        }
+        return true;
+    }
+    
+    bool parseAnd()
+    {
+        if (!parseComparison())
+            return false;
+        while (accept("&&"))
+        {
+            if (!parseComparison())
+                return false;
+            emit(OP_AND, 0);
+        }
+        return true;
+    }
+    
+    bool parseComparison()
+    {
+        if (!parseSum())
+            return false;
+        
+        ExprOp op;
+        if (accept("<="))
+            op = OP_LE;
+        else if (accept(">="))
+            op = OP_GE;
+        else if (accept("=="))
+            op = OP_EQ;
+        else if (accept("!="))
+            op = OP_NE;
+        else if (accept("<"))
+            op = OP_LT;
+        else if (accept(">"))
+            op = OP_GT;
+        else
+            return true;
+        
+        if (!parseSum())
+            return false;
+        emit(op, 0);
+        return true;
+    }
+    
+    bool parseSum()
+    {
+        if (!parseTerm())
+            return false;
+        while (true)
+        {
+            ExprOp op;
+            if (accept("+"))
+                op = OP_ADD;
+            else if (accept("-"))
+                op = OP_SUB;
+            else
+                return true;
+            
+            if (!parseTerm())
+                return false;
+            emit(op, 0);
+        }
+    }
+    
+    bool parseTerm()
+    {
+        if (!parseUnary())
+            return false;
+        while (true)
+        {
+            ExprOp op;
+            if (accept("*"))
+                op = OP_MUL;
+            else if (accept("/"))
+                op = OP_DIV;
+            else if (accept("%"))
+                op = OP_MOD;
+            else
+                return true;
+            
+            if (!parseUnary())
+                return false;
+            emit(op, 0);
+        }
+    }
+    
+    bool parseUnary()
+    {
+        // check for '!=' so that it is not mistaken for a '!' in front of an operand
+        skipSpaces();
+        if (p[0] == '!' && p[1] != '=')
+        {
+            p++;
+            if (!nest() || !parseUnary())
+                return false;
+            nesting--;
+            emit(OP_NOT, 0);
+            return true;
+        }
+        if (accept("-"))
+        {
+            if (!nest() || !parseUnary())
+                return false;
+            nesting--;
+            emit(OP_NEG, 0);
+            return true;
+        }
+        return parsePrimary();
+    }
+    
+    bool parsePrimary()
+    {
+        skipSpaces();
+        
+        if (*p >= '0' && *p <= '9')
+        {
+            long long value = 0;
+            while (*p >= '0' && *p <= '9')
+            {
+                value = value*10 + (*p++ - '0');
+                if (value > 2147483647LL)
+                    return fail("number too large");
+            }
+            emit(OP_CONST, (int)value);
+            return true;
+        }
+        
+        if (p[0] == '\'' && p[1] != '\0' && p[2] == '\'')
+        {
+            emit(OP_CONST, (unsigned char)p[1]);
+            p += 3;
+            return true;
+        }
+        
+        if (accept("("))
+        {
+            if (!nest() || !parseOr())
+                return false;
+            nesting--;
+            if (!accept(")"))
+                return fail("expected ')'");
+            return true;
+        }
+        
+        const char* start = p;
+        while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))
+            p++;
+        std::string name(start, (size_t)(p - start));
+        
+        if (name == "x")
+            emit(OP_LOAD, 0);
+        else if (name == "c")
+            emit(OP_LOAD, 1);
+        else if (name == "isEven")
+            return parseShorthand("x % 2 == 0");
+        else if (name == "firstHalf")
+            return parseShorthand("c > 0 && c <= 'M'");
+        else if (name.empty())
+            return fail("expected a value");
+        else
+            return fail("unknown name");
+        return true;
+    }
+};
+
+// Compiles the text of an expression. On failure, returns false and describes the problem in 'error'.
+bool compileExpression(const char* text, Expression& expr, std::string& error)
+{
+    ExpressionParser parser(text, expr);
+    return parser.parse(error);
+}
+
+// Operators for the column loops in 'evaluateExpression'. Arithmetic wraps around rather than overflowing, and
+// division or remainder by zero gives zero, so that no input can make an expression crash. 'lanes' is the same
+// operation on a vector of a lanes backend; division and remainder have none, and always run one value at a time.
+struct AddOp
+{
+    static int apply(int a, int b) { return (int)((unsigned)a + (unsigned)b); }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::add(a, b); }
+};
+
+struct SubOp
+{
+    static int apply(int a, int b) { return (int)((unsigned)a - (unsigned)b); }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::sub(a, b); }
+};
+
+struct MulOp
+{
+    static int apply(int a, int b) { return (int)((unsigned)a * (unsigned)b); }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::mul(a, b); }
+};
+
+struct DivOp { static int apply(int a, int b) { return b == 0 ? 0 : (b == -1 ? (int)(0u - (unsigned)a) : a / b); } };
+struct ModOp { static int apply(int a, int b) { return (b == 0 || b == -1) ? 0 : a % b; } };
+
+struct LtOp
+{
+    static int apply(int a, int b) { return a < b; }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::less(a, b); }
+};
+
+struct LeOp
+{
+    static int apply(int a, int b) { return a <= b; }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::sub(L::splat(1), L::greater(a, b)); }
+};
+
+struct GtOp
+{
+    static int apply(int a, int b) { return a > b; }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::greater(a, b); }
+};
+
+struct GeOp
+{
+    static int apply(int a, int b) { return a >= b; }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::sub(L::splat(1), L::less(a, b)); }
+};
+
+struct EqOp
+{
+    static int apply(int a, int b) { return a == b; }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::equal(a, b); }
+};
+
+struct NeOp
+{
+    static int apply(int a, int b) { return a != b; }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b) { return L::sub(L::splat(1), L::equal(a, b)); }
+};
+
+// (a != 0) & (b != 0) is 1 - ((a == 0) | (b == 0)), and for 0/1 values x | y is x + y - (x & y)
+struct AndOp
+{
+    static int apply(int a, int b) { return (a != 0) & (b != 0); }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b)
+    {
+        typename L::vector zero = L::splat(0);
+        typename L::vector x = L::equal(a, zero), y = L::equal(b, zero);
+        return L::sub(L::splat(1), L::sub(L::add(x, y), L::bitAnd(x, y)));
+    }
+};
+
+// (a != 0) | (b != 0) is 1 - ((a == 0) & (b == 0))
+struct OrOp
+{
+    static int apply(int a, int b) { return (a != 0) | (b != 0); }
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b)
+    {
+        typename L::vector zero = L::splat(0);
+        return L::sub(L::splat(1), L::bitAnd(L::equal(a, zero), L::equal(b, zero)));
+    }
+};
+
+// b is a positive power of two; same result as a % b, including for negative a
+struct ModPow2Op
+{
+    static int apply(int a, int b)
+    {
+        int r = a & (b-1);
+        return r - (b & -(int)(a < 0 && r != 0));
+    }
+    
+    template<typename L> static typename L::vector lanes(typename L::vector a, typename L::vector b)
+    {
+        typename L::vector zero = L::splat(0);
+        typename L::vector r = L::bitAnd(a, L::sub(b, L::splat(1)));
+        typename L::vector adjust = L::bitAnd(L::less(a, zero), L::sub(L::splat(1), L::equal(r, zero)));
+        return L::sub(r, L::bitAnd(b, L::sub(zero, adjust)));
+    }
+};
+
+// Applies a binary operator down a whole column, with the right hand side either a second column or a constant,
+// one value at a time
+template<typename Op>
+void applyColumn(int* lhs, const int* rhs, const ExprInstruction& instruction, int n)
+{
+    if (instruction.immediate)
+    {
+        int b = instruction.operand;
+        for (int i = 0; i < n; i++)
+            lhs[i] = Op::apply(lhs[i], b);
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
+            lhs[i] = Op::apply(lhs[i], rhs[i]);
+    }
+}
+
+// Same as 'applyColumn', a vector of the lanes backend at a time
+template<typename Lanes, typename Op>
+void applyColumnLanes(int* lhs, const int* rhs, const ExprInstruction& instruction, int n)
+{
+    int i = 0;
+    if (instruction.immediate)
+    {
+        typename Lanes::vector b = Lanes::splat(instruction.operand);
+        for (; i + Lanes::width <= n; i += Lanes::width)
+            Lanes::store(lhs+i, Op::template lanes<Lanes>(Lanes::load(lhs+i), b));
+        for (; i < n; i++)
+            lhs[i] = Op::apply(lhs[i], instruction.operand);
+    }
+    else
+    {
+        for (; i + Lanes::width <= n; i += Lanes::width)
+            Lanes::store(lhs+i, Op::template lanes<Lanes>(Lanes::load(lhs+i), Lanes::load(rhs+i)));
+        for (; i < n; i++)
+            lhs[i] = Op::apply(lhs[i], rhs[i]);
+    }
+}
+
+// Evaluates a compiled expression with a given lanes backend for 'count' elements, where columns[v][i] is the
+// value of variable v for element i, storing whether the expression is nonzero for each element in results[i].
+// The stack holds one column of 'batch' values per level, so its size is fixed by the expression, not by 'count'.
+template<typename Lanes>
+void evaluateExpression(const Expression& expr, const int* const* columns, int count, bool* results)
+{
+    const int batch = 256;
+    
+    // unary operators are run as binary ones with a constant: -x is x * -1, and !x is x == 0
+    const ExprInstruction negate = { OP_MUL, -1, true };
+    const ExprInstruction isZero = { OP_EQ, 0, true };
+    
+    std::vector<int> stack((size_t)(expr.maxDepth > 0 ? expr.maxDepth : 1) * batch);
+    
+    for (int start = 0; start < count; start += batch)
+    {
+        int n = count - start < batch ? count - start : batch;
+        int depth = 0;
+        
+        for (size_t k = 0; k < expr.code.size(); k++)
+        {
+            const ExprInstruction& instruction = expr.code[k];
+            int* top = &stack[(size_t)(depth > 0 ? depth-1 : 0) * batch];
+            
+            switch (instruction.op)
+            {
+                case OP_LOAD:
+                    memcpy(&stack[(size_t)depth * batch], columns[instruction.operand] + start, (size_t)n * sizeof(int));
+                    depth++;
+                    continue;
+                case OP_CONST:
+                    std::fill(&stack[(size_t)depth * batch], &stack[(size_t)depth * batch] + n, instruction.operand);
+                    depth++;
+                    continue;
+                case OP_NEG:
+                    applyColumnLanes<Lanes, MulOp>(top, top, negate, n);
+                    continue;
+                case OP_NOT:
+                    applyColumnLanes<Lanes, EqOp>(top, top, isZero, n);
+                    continue;
+                default:
+                    break;
+            }
+            
+            // binary operator: the left hand side is below the top unless the right hand side is immediate
+            int* lhs = instruction.immediate ? top : top - batch;
+            switch (instruction.op)
+            {
+                case OP_ADD: applyColumnLanes<Lanes, AddOp>(lhs, top, instruction, n); break;
+                case OP_SUB: applyColumnLanes<Lanes, SubOp>(lhs, top, instruction, n); break;
+                case OP_MUL: applyColumnLanes<Lanes, MulOp>(lhs, top, instruction, n); break;
+                case OP_DIV: applyColumn<DivOp>(lhs, top, instruction, n); break;
+                case OP_MOD: applyColumn<ModOp>(lhs, top, instruction, n); break;
+                case OP_MODPOW2: applyColumnLanes<Lanes, ModPow2Op>(lhs, top, instruction, n); break;
+                case OP_LT: applyColumnLanes<Lanes, LtOp>(lhs, top, instruction, n); break;
+                case OP_LE: applyColumnLanes<Lanes, LeOp>(lhs, top, instruction, n); break;
+                case OP_GT: applyColumnLanes<Lanes, GtOp>(lhs, top, instruction, n); break;
+                case OP_GE: applyColumnLanes<Lanes, GeOp>(lhs, top, instruction, n); break;
+                case OP_EQ: applyColumnLanes<Lanes, EqOp>(lhs, top, instruction, n); break;
+                case OP_NE: applyColumnLanes<Lanes, NeOp>(lhs, top, instruction, n); break;
+                case OP_AND: applyColumnLanes<Lanes, AndOp>(lhs, top, instruction, n); break;
+                case OP_OR: applyColumnLanes<Lanes, OrOp>(lhs, top, instruction, n); break;
+                default: break;
+            }
+            if (!instruction.immediate)
+                depth--;
+        }
+        
+        for (int i = 0; i < n; i++)
+            results[start+i] = stack[i] != 0;
+    }
+}
+
+// Evaluates an expression with the currently selected lanes backend
+void evaluateExpression(const Expression& expr, const int* const* columns, int count, bool* results)
+{
+    switch (simdBackend())
+    {
+#if defined(__SSE2__)
+        case SIMD_SSE2: evaluateExpression<SseLanes>(expr, columns, count, results); break;
+#endif
+#if defined(HAVE_X86_DISPATCH)
+        case SIMD_SSE42: evaluateExpressionSse42(expr, columns, count, results); break;
+        case SIMD_AVX2: evaluateExpressionAvx2(expr, columns, count, results); break;
+        case SIMD_AVX512: evaluateExpressionAvx512(expr, columns, count, results); break;
+#endif
+#if defined(__ARM_NEON)
+        case SIMD_NEON: evaluateExpression<NeonLanes>(expr, columns, count, results); break;
+#endif
+        default: evaluateExpression<ScalarLanes>(expr, columns, count, results); break;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+// 64-bit FNV-1a hash, used as the partition file checksum
+uint64_t checksumBytes(const char* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Writes all of data to fd, retrying after partial writes. Returns false if a write fails.
+bool writeAll(int fd, const char* data, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t result = write(fd, data + written, size - written);
+        if (result < 0)
+            return false;
+        written += (size_t)result;
+    }
+    return true;
+}
+
+// Writes an already partitioned list to a partition file. T must be trivially copyable, since the elements are
+// written as raw bytes.
+template<typename T>
+bool writePartitionFile(const char* path, const std::vector<T>& list, int partitionPoint)
+{
+    PartitionFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "STBLPART", 8);
+    header.version = 1;
+    header.elementSize = (uint32_t)sizeof(T);
+    header.count = list.size();
+    header.partitionPoint = (uint64_t)partitionPoint;
+    header.payloadOffset = sizeof(PartitionFileHeader);
+    
+    const char* payload = list.empty() ? NULL : (const char*)&list[0];
+    size_t payloadSize = list.size() * sizeof(T);
+    header.checksum = checksumBytes(payload, payloadSize);
+    
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    
+    bool ok = writeAll(fd, (const char*)&header, sizeof(header)) && writeAll(fd, payload, payloadSize);
+    return close(fd) == 0 && ok;
+}
+
+// Maps a partition file and checks its header. Verifying the checksum reads the whole payload, so readers that
+// only want part of a large file may prefer to skip it. The payload must start after the header on a 64 byte
+// boundary, which leaves it aligned for any element type since the mapping itself is page aligned.
+bool openPartitionFile(const char* path, PartitionFileView& view, bool verify, std::string& error)
+{
+    view.mapping = mapInputFile(path, view.mappingSize);
+    if (view.mapping == NULL)
+    {
+        error = strerror(errno);
+        return false;
+    }
+    
+    view.header = (const PartitionFileHeader*)view.mapping;
+    
+    if (view.mappingSize < sizeof(PartitionFileHeader) || memcmp(view.header->magic, "STBLPART", 8) != 0)
+        error = "not a partition file";
+    else if (view.header->version != 1)
+        error = "unsupported partition file version";
+    else if (view.header->payloadOffset < sizeof(PartitionFileHeader) || view.header->payloadOffset % 64 != 0)
+        error = "partition file payload is misaligned";
+    else if (view.header->payloadOffset > view.mappingSize || view.header->elementSize == 0 ||
+             view.header->count > (view.mappingSize - view.header->payloadOffset) / view.header->elementSize ||
+             view.header->partitionPoint > view.header->count)
+        error = "partition file is truncated or corrupt";
+    else
+    {
+        view.payload = view.mapping + view.header->payloadOffset;
+        if (!verify || checksumBytes(view.payload, view.header->count * view.header->elementSize) == view.header->checksum)
+            return true;
+        error = "partition file checksum mismatch";
+    }
+    
+    closePartitionFile(view);
+    return false;
+}
+
+void closePartitionFile(PartitionFileView& view)
+{
+    unmapInputFile(view.mapping, view.mappingSize);
+    view.mapping = NULL;
+    view.mappingSize = 0;
+    view.header = NULL;
+    view.payload = NULL;
+}
+
+// Returns the payload of an open partition file as an array of T, or NULL if the file holds elements of a
+// different size or the payload is not aligned for T.
+template<typename T>
+const T* partitionFileElements(const PartitionFileView& view)
+{
+    if (view.header->elementSize != sizeof(T) || (uintptr_t)view.payload % std::alignment_of<T>::value != 0)
+        return NULL;
+    return (const T*)view.payload;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+static void printUsage(const char* program)
+{
+    cerr << "Usage: " << program << " -p predicate [-k field] [-d delimiter] input [trueOutput [falseOutput]]" << endl << endl;
+    cerr << "Stably partitions the lines of input, writing the 'true' lines followed by the 'false' lines to trueOutput" << endl;
+    cerr << "(standard output if omitted or '-'). If falseOutput is given, the 'false' lines are written there instead." << endl << endl;
+    cerr << "  -p predicate   expression over x (field parsed as an int) and c (first character of field, 0 if empty)," << endl;
+    cerr << "                 e.g. \"x % 3 == 0 || x < 0\" or \"c >= 'A' && c <= 'M'\", or isEven or firstHalf" << endl;
+    cerr << "  -k field       0-based field of each line to test, default is the whole line" << endl;
+    cerr << "  -d delimiter   field delimiter character, default ','" << endl;
+    cerr << "  -b output      instead of text, write the partitioned key fields as ints to a binary partition file" << endl;
+    cerr << "  -v kernels     vector kernels to use: scalar, sse2, sse4.2, avx2, avx512 or neon, default is the fastest" << endl;
+    cerr << "                 supported (" << simdBackendName(bestSimdBackend()) << " here)" << endl << endl;
+    cerr << "       " << program << " -s file" << endl << endl;
+    cerr << "Checks a binary partition file and prints its element count and partition point." << endl << endl;
+    cerr << "       " << program << " -t count" << endl << endl;
+    cerr << "Checks the partitioning functions on strings, then times the rotation, merging and partitioning functions on" << endl;
+    cerr << "count random ints and counts the writes each partitioning function makes." << endl;
+}
+
+// Opens an output path for writing, with '-' meaning standard output. Returns -1 on failure.
+static int openOutput(const char* path)
+{
+    if (strcmp(path, "-") == 0)
+        return STDOUT_FILENO;
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+// Whether two paths (either of which may be "-" for standard output) name the same existing regular file. Opening
+// an output truncates it, which must not happen to the input while it is mapped, or to the other output once
+// written. A terminal or pipe can be shared by both outputs.
+static bool sameFile(const char* a, const char* b)
+{
+    // both outputs on standard output are written through the one descriptor
+    if (strcmp(a, "-") == 0 && strcmp(b, "-") == 0)
+        return false;
+    
+    struct stat infoA, infoB;
+    if ((strcmp(a, "-") == 0 ? fstat(STDOUT_FILENO, &infoA) : stat(a, &infoA)) != 0 || !S_ISREG(infoA.st_mode))
+        return false;
+    if ((strcmp(b, "-") == 0 ? fstat(STDOUT_FILENO, &infoB) : stat(b, &infoB)) != 0 || !S_ISREG(infoB.st_mode))
+        return false;
+    return infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+}
+
+// Prints the header of a partition file after verifying its checksum
+static int describePartitionFile(const char* path)
+{
+    PartitionFileView view;
+    std::string error;
+    if (!openPartitionFile(path, view, true, error))
+    {
+        cerr << "Could not read " << path << ": " << error << endl;
+        return 1;
+    }
+    
+    cout << "element size:    " << view.header->elementSize << endl;
+    cout << "count:           " << view.header->count << endl;
+    cout << "partition point: " << view.header->partitionPoint << endl;
+    
+    closePartitionFile(view);
+    return 0;
+}
+
+// An int that counts assignments to it while it is in the list being partitioned, for counting the writes each
+// partitioning function makes to the list (writes to temporaries and buffers are not counted)
+struct CountedInt
+{
+    int value;
+    static long long writes;
+    static const CountedInt* listBegin;
+    static const CountedInt* listEnd;
+    
+    CountedInt() : value(0) {}
+    CountedInt(const CountedInt& other) : value(other.value) {}
+    CountedInt& operator=(const CountedInt& other)
+    {
+        value = other.value;
+        if (this >= listBegin && this < listEnd)
+            writes++;
+        return *this;
+    }
+};
+
+long long CountedInt::writes = 0;
+const CountedInt* CountedInt::listBegin = NULL;
+const CountedInt* CountedInt::listEnd = NULL;
+
+static bool countedIsEven(const CountedInt& c)
+{
+    return isEven(c.value);
+}
+
+// Runs 'run' on a copy of 'values' and returns the number of writes it made per element
+template<typename Function>
+static double writesOnCopy(const std::vector<int>& values, Function run)
+{
+    std::vector<CountedInt> copy(values.size());
+    for (size_t i = 0; i < values.size(); i++)
+        copy[i].value = values[i];
+    
+    CountedInt::writes = 0;
+    CountedInt::listBegin = &copy[0];
+    CountedInt::listEnd = &copy[0] + copy.size();
+    run(copy);
+    return (double)CountedInt::writes / values.size();
+}
+
+// Runs 'run' on a copy of 'values' and returns how long it took in milliseconds
+template<typename List, typename Function>
+static double timeOnCopy(const List& values, Function run)
+{
+    List copy = values;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    run(copy);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A 64-byte record, heavy enough that moving whole chunks instead of elements shows in the chunked list benchmark
+struct BenchmarkRecord
+{
+    int key;
+    int payload[15];
+};
+
+static bool recordIsEven(const BenchmarkRecord& record)
+{
+    return isEven(record.key);
+}
+
+static long long predicateCalls = 0;
+
+static bool countingIsEven(int value)
+{
+    predicateCalls++;
+    return isEven(value);
+}
+
+// Times 'run' on a copy of 'values' and prints how long it took and how many times it called the boolean function
+template<typename Function>
+static void benchmarkCalls(const std::vector<int>& values, const char* name, Function run)
+{
+    predicateCalls = 0;
+    double ms = timeOnCopy(values, run);
+    cout << name << ": " << ms << " ms, " << (double)predicateCalls / values.size() << " calls per element" << endl;
+}
+
+// Times stablepartition on 'records' stored as a vector, a deque and a chunked list of 'chunkSize' records
+static void benchmarkContainers(const std::vector<BenchmarkRecord>& records, int chunkSize, const char* name)
+{
+    ChunkedList<BenchmarkRecord> chunked;
+    makeChunkedList(records, chunkSize, chunked);
+    std::deque<BenchmarkRecord> deque(records.begin(), records.end());
+    cout << "stablepartition vector of records, " << name << ": "
+         << timeOnCopy(records, [](std::vector<BenchmarkRecord>& list) { stablepartition(list, recordIsEven); })
+         << " ms" << endl;
+    cout << "stablepartition deque of records, " << name << ": "
+         << timeOnCopy(deque, [](std::deque<BenchmarkRecord>& list) { stablepartition(list, recordIsEven); })
+         << " ms" << endl;
+    cout << "stablepartition chunked list of records, " << name << ": "
+         << timeOnCopy(chunked, [](ChunkedList<BenchmarkRecord>& list) { stablepartition(list, recordIsEven); })
+         << " ms" << endl;
+}
+
+// Reference merge for the benchmarks: the textbook recursive rotation merge that std::inplace_merge falls back to
+// when it cannot get a buffer, so 'inplacemerge' can be compared against both of the standard library's paths
+template<typename Iterator>
+static void mergeWithoutBuffer(Iterator first, Iterator middle, Iterator last)
+{
+    if (first == middle || middle == last)
+        return;
+    if (last - first == 2)
+    {
+        if (*middle < *first)
+            std::iter_swap(first, middle);
+        return;
+    }
+    
+    // split the longer run in half and find where its middle element falls in the other run
+    Iterator firstCut, secondCut;
+    if (middle - first > last - middle)
+    {
+        firstCut = first + (middle - first)/2;
+        secondCut = std::lower_bound(middle, last, *firstCut);
+    }
+    else
+    {
+        secondCut = middle + (last - middle)/2;
+        firstCut = std::upper_bound(first, middle, *secondCut);
+    }
+    Iterator newMiddle = std::rotate(firstCut, middle, secondCut);
+    mergeWithoutBuffer(first, firstCut, newMiddle);
+    mergeWithoutBuffer(newMiddle, secondCut, last);
+}
+
+// Example boolean function over strings of digits: whether the number they spell is even
+static bool isEvenString(const std::string& s)
+{
+    return !s.empty() && isEven(s[s.size()-1] - '0');
+}
+
+// Checks that a partitioning function given a copy of 'strings' produces 'expected', printing its name if not.
+// Strings are used since, unlike ints, they show up elements that were lost or duplicated by a bad move.
+template<typename Function>
+static bool checkOnCopy(const char* name, const std::vector<std::string>& strings, const std::vector<std::string>& expected,
+                        Function run)
+{
+    std::vector<std::string> copy = strings;
+    run(copy);
+    if (copy != expected)
+        cerr << "Self-check failed: " << name << endl;
+    return copy == expected;
+}
+
+// Node of an intrusive singly linked list, for checking 'stablepartitionlinked'
+struct StringNode
+{
+    std::string value;
+    StringNode* next;
+};
+
+// Checks 'stablepartitionlinked' on an intrusive list of 'strings' against std::stable_partition. The nodes are walked
+// no further than there are of them, so a cycle shows up as a wrong list rather than a hang.
+static bool checkLinked(const std::vector<std::string>& strings)
+{
+    std::vector<std::string> expected = strings;
+    std::stable_partition(expected.begin(), expected.end(), isEvenString);
+    
+    std::vector<StringNode> nodes(strings.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].value = strings[i];
+        nodes[i].next = i+1 < nodes.size() ? &nodes[i+1] : NULL;
+    }
+    StringNode* head = nodes.empty() ? NULL : &nodes[0];
+    StringNode* falseHead = stablepartitionlinked(head, [](const StringNode& node) { return isEvenString(node.value); });
+    
+    std::vector<std::string> values;
+    StringNode* firstFalse = NULL;
+    for (StringNode* node = head; node != NULL && values.size() <= nodes.size(); node = node->next)
+    {
+        if (firstFalse == NULL && !isEvenString(node->value))
+            firstFalse = node;
+        values.push_back(node->value);
+    }
+    
+    if (values != expected || falseHead != firstFalse)
+        cerr << "Self-check failed: stablepartitionlinked" << endl;
+    return values == expected && falseHead == firstFalse;
+}
+
+// Checks the partitioning functions for other containers and encodings against 'expected', the stable partition of
+// 'strings' by isEvenString, printing the name of any that disagree
+static bool checkContainers(const std::vector<std::string>& strings, const std::vector<std::string>& expected)
+{
+    typedef std::vector<std::string> Strings;
+    bool ok = true;
+    
+    std::list<std::string> linked(strings.begin(), strings.end());
+    stablepartition(linked, isEvenString);
+    ok &= checkOnCopy("stablepartition (list)", Strings(linked.begin(), linked.end()), expected, [](Strings&) {});
+    
+    std::forward_list<std::string> forward(strings.begin(), strings.end());
+    stablepartition(forward, isEvenString);
+    ok &= checkOnCopy("stablepartition (forward_list)", Strings(forward.begin(), forward.end()), expected,
+                      [](Strings&) {});
+    
+    // both ways the list can end, since the last node of each section needs its link fixing up differently
+    ok &= checkLinked(strings);
+    Strings endingTrue = strings;
+    endingTrue.push_back("0");
+    ok &= checkLinked(endingTrue);
+    Strings endingFalse = strings;
+    endingFalse.push_back("1");
+    ok &= checkLinked(endingFalse);
+    
+    std::deque<std::string> queue(strings.begin(), strings.end());
+    stablepartition(queue, isEvenString);
+    ok &= checkOnCopy("stablepartition (deque)", Strings(queue.begin(), queue.end()), expected, [](Strings&) {});
+    
+    ok &= checkOnCopy("stablepartition (ChunkedList)", strings, expected, [](Strings& list)
+        {
+            ChunkedList<std::string> chunked;
+            makeChunkedList(list, 1000, chunked);
+            stablepartition(chunked, isEvenString);
+            for (int i = 0; i < chunked.size(); i++)
+                list[i] = chunked[i];
+        });
+    
+    // rebuild the rope over itself to check the old nodes are released, then rotate it back and forth
+    ok &= checkOnCopy("stablepartition (Rope)", strings, expected, [](Strings& list)
+        {
+            Rope<std::string> rope;
+            makeRope(list, 1, rope);
+            makeRope(list, 64, rope);
+            int middle = rope.size()/3;
+            rotate(rope, 0, middle, rope.size()-1);
+            rotate(rope, 0, rope.size()-middle, rope.size()-1);
+            stablepartition(rope, isEvenString);
+            flattenRope(rope, list);
+        });
+    
+    ok &= checkOnCopy("stablepartitionruns", strings, expected, [](Strings& list)
+        {
+            std::vector< Run<std::string> > runs;
+            encodeRuns(list, runs);
+            stablepartitionruns(runs, isEvenString);
+            decodeRuns(runs, list);
+        });
+    
+    ok &= checkOnCopy("PartitionedVector", strings, expected, [](Strings& list)
+        {
+            PartitionedVector<std::string, bool (*)(const std::string&)> partitioned(isEvenString);
+            appendPartitioned(partitioned, list);
+            flattenPartitioned(partitioned, list);
+        });
+    
+    // transform each side differently, so that a misplaced transformation shows up
+    Strings transformed = expected;
+    for (size_t i = 0; i < transformed.size(); i++)
+        transformed[i] += isEvenString(transformed[i]) ? "e" : "o";
+    ok &= checkOnCopy("stablepartitiontransform", strings, transformed, [](Strings& list)
+        {
+            stablepartitiontransform(list, isEvenString, [](const std::string& s) { return s + "e"; },
+                                     [](const std::string& s) { return s + "o"; });
+        });
+    
+    SideSummary<std::string> evens, odds;
+    Strings reduced = strings;
+    stablepartitionreduce(reduced, isEvenString, evens, odds);
+    int evenCount = (int)(std::partition_point(expected.begin(), expected.end(), isEvenString) - expected.begin());
+    Strings::const_iterator evenEnd = expected.begin() + evenCount;
+    bool summarized = evens.count == evenCount && odds.count == (int)expected.size() - evenCount &&
+                      (evens.count == 0 || evens.min == *std::min_element(expected.begin(), evenEnd)) &&
+                      (odds.count == 0 || odds.max == *std::max_element(evenEnd, expected.end()));
+    ok &= checkOnCopy("stablepartitionreduce", reduced, summarized ? expected : Strings(), [](Strings&) {});
+    
+    return ok;
+}
+
+// Checks each Stability mode of 'stablepartition' on the first 'count' of 'strings': that the result is partitioned at
+// the index returned, is a permutation of the input, and keeps the order of each section the mode promises to
+static bool checkStabilities(const std::vector<std::string>& strings, int count)
+{
+    typedef std::vector<std::string> Strings;
+    const char* names[] = { "stable", "stable trues", "stable falses", "unstable" };
+    
+    Strings input(strings.begin(), strings.begin() + count);
+    Strings expected = input;
+    int trues = (int)(std::stable_partition(expected.begin(), expected.end(), isEvenString) - expected.begin());
+    Strings sorted = input;
+    std::sort(sorted.begin(), sorted.end());
+    
+    bool ok = true;
+    for (int stability = STABLE; stability <= UNSTABLE; stability++)
+    {
+        Strings list = input;
+        int point = stablepartition(list, isEvenString, (Stability)stability);
+        
+        bool partitioned = point == trues && std::is_partitioned(list.begin(), list.end(), isEvenString);
+        bool stableTrues = std::equal(list.begin(), list.begin() + trues, expected.begin());
+        bool stableFalses = std::equal(list.begin() + trues, list.end(), expected.begin() + trues);
+        Strings permutation = list;
+        std::sort(permutation.begin(), permutation.end());
+        
+        if (!partitioned || permutation != sorted ||
+            ((stability == STABLE || stability == STABLE_TRUES) && !stableTrues) ||
+            ((stability == STABLE || stability == STABLE_FALSES) && !stableFalses))
+        {
+            cerr << "Self-check failed: " << names[stability] << " partition of " << count << " elements" << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Checks that each 'stableunpartition' puts the first 'count' of 'strings' back in their original order after they
+// have been stably partitioned, given the selection taken beforehand
+static bool checkUnpartitions(const std::vector<std::string>& strings, int count)
+{
+    typedef std::vector<std::string> Strings;
+    Strings input(strings.begin(), strings.begin() + count);
+    
+    std::vector<uint64_t> selected;
+    makeSelection(input, isEvenString, selected);
+    std::vector<bool> outcomes(input.size());
+    for (int i = 0; i < count; i++)
+        outcomes[i] = isEvenString(input[i]);
+    
+    Strings partitioned = input;
+    stablepartition(partitioned, isEvenString);
+    
+    bool ok = true;
+    ok &= checkOnCopy("stableunpartition (bitmap)", partitioned, input,
+                      [&selected](Strings& list) { stableunpartition(list, selected); });
+    ok &= checkOnCopy("stableunpartition (vector<bool>)", partitioned, input,
+                      [&outcomes](Strings& list) { stableunpartition(list, outcomes); });
+    const int threads[] = { 1, 3, 8 };
+    for (int t = 0; t < 3; t++)
+    {
+        int n = threads[t];
+        ok &= checkOnCopy("stableunpartitionparallel", partitioned, input,
+                          [&selected, n](Strings& list) { stableunpartitionparallel(list, selected, n); });
+    }
+    return ok;
+}
+
+// Checks partitioning by a selection (as a bitmap, as a list of indexes and, for ints, by 'stablepartitioncompact' with
+// each vector backend this machine supports) against std::stable_partition of the elements' original indexes by the
+// same selection, on lists of 'count' elements with about 1 in 'spread' selected
+static bool checkSelections(int count, int spread)
+{
+    std::vector<int> values(count);
+    std::vector<std::string> strings(count);
+    std::vector<uint64_t> selected((count+63)/64, 0);
+    std::vector<int> indices;
+    for (int i = 0; i < count; i++)
+    {
+        values[i] = i;
+        strings[i] = std::to_string(i);
+        if (rand() % spread == 0)
+        {
+            selected[i >> 6] |= (uint64_t)1 << (i & 63);
+            indices.push_back(i);
+        }
+    }
+    
+    std::vector<int> expected = values;
+    int trues = (int)(std::stable_partition(expected.begin(), expected.end(), [&selected](int i)
+        { return (selected[i >> 6] >> (i & 63) & 1) != 0; }) - expected.begin());
+    std::vector<std::string> expectedStrings(count);
+    for (int i = 0; i < count; i++)
+        expectedStrings[i] = std::to_string(expected[i]);
+    
+    bool ok = true;
+    std::vector<int> list = values;
+    ok &= stablepartition(list, selected) == trues && list == expected;
+    list = values;
+    ok &= stablepartition(list, indices) == trues && list == expected;
+    std::vector<std::string> stringList = strings;
+    ok &= stablepartition(stringList, selected) == trues && stringList == expectedStrings;
+    stringList = strings;
+    ok &= stablepartition(stringList, indices) == trues && stringList == expectedStrings;
+    if (!ok)
+        cerr << "Self-check failed: stablepartition by selection of " << count << " elements" << endl;
+    
+    SimdBackend saved = simdBackend();
+    for (int backend = SIMD_SCALAR; backend <= SIMD_NEON; backend++)
+    {
+        if (!setSimdBackend((SimdBackend)backend))
+            continue;
+        list = values;
+        if (stablepartitioncompact(list, selected) != trues || list != expected)
+        {
+            cerr << "Self-check failed: stablepartitioncompact (" << simdBackendName((SimdBackend)backend) << ") of "
+                 << count << " elements" << endl;
+            ok = false;
+        }
+    }
+    setSimdBackend(saved);
+    return ok;
+}
+
+// Checks the vector kernels of each backend this machine supports against the scalar backend on random data, at
+// lengths either side of each lane count and batch size so that every tail loop is run
+static bool checkVectorKernels()
+{
+    const int lengths[] = { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 255, 256, 257, 1000 };
+    const int lengthCount = (int)(sizeof(lengths)/sizeof(lengths[0]));
+    const char* expressions[] = { "isEven", "firstHalf", "x % 8 == 3 || c == 'A'", "x * 3 - 5 > c && !(x < 0)",
+                                  "x / 3 != -x % 5", "x >= -100 && x <= 100", "-x + c * 2 < 7 || x % 16 != 0" };
+    const int expressionCount = (int)(sizeof(expressions)/sizeof(expressions[0]));
+    
+    // values small enough that no expression above overflows
+    const int size = 1000;
+    std::vector<int> xs(size), cs(size);
+    bool flags[size];
+    std::vector<char> bytes(size + 64);
+    for (int i = 0; i < size; i++)
+    {
+        xs[i] = rand() % 2001 - 1000;
+        cs[i] = rand() % 128;
+        flags[i] = rand() % 2 == 0;
+    }
+    for (size_t i = 0; i < bytes.size(); i++)
+        bytes[i] = (char)(rand() % 200 == 0 ? '\n' : 'a' + rand() % 26);
+    const int* columns[2] = { &xs[0], &cs[0] };
+    
+    // results of the scalar backend, for every length and starting offset
+    SimdBackend saved = simdBackend();
+    setSimdBackend(SIMD_SCALAR);
+    std::vector< std::vector<int> > compacted(2*lengthCount);
+    std::vector< std::vector<bool> > evaluated(expressionCount*lengthCount);
+    std::vector<const char*> found(64*lengthCount);
+    std::vector<Expression> compiled(expressionCount);
+    for (int e = 0; e < expressionCount; e++)
+    {
+        std::string error;
+        compileExpression(expressions[e], compiled[e], error);
+    }
+    for (int l = 0; l < lengthCount; l++)
+    {
+        for (int keep = 0; keep < 2; keep++)
+        {
+            std::vector<int>& out = compacted[2*l + keep];
+            out.resize((size_t)lengths[l] + 1);
+            out.resize(compactInts(&xs[0], flags, lengths[l], keep != 0, &out[0]));
+        }
+        for (int e = 0; e < expressionCount; e++)
+        {
+            bool results[size];
+            evaluateExpression(compiled[e], columns, lengths[l], results);
+            evaluated[e*lengthCount + l].assign(results, results + lengths[l]);
+        }
+        for (int offset = 0; offset < 64; offset++)
+            found[64*l + offset] = findByte(&bytes[offset], &bytes[offset] + lengths[l], '\n');
+    }
+    
+    bool ok = true;
+    for (int backend = SIMD_SSE2; backend <= SIMD_NEON; backend++)
+    {
+        if (!setSimdBackend((SimdBackend)backend))
+            continue;
+        const char* name = simdBackendName((SimdBackend)backend);
+        
+        for (int l = 0; l < lengthCount; l++)
+        {
+            for (int keep = 0; keep < 2; keep++)
+            {
+                std::vector<int> out((size_t)lengths[l] + 1);
+                out.resize(compactInts(&xs[0], flags, lengths[l], keep != 0, &out[0]));
+                if (out != compacted[2*l + keep])
+                {
+                    cerr << "Self-check failed: compactInts (" << name << ") of " << lengths[l] << " ints" << endl;
+                    ok = false;
+                }
+            }
+            for (int e = 0; e < expressionCount; e++)
+            {
+                bool results[size];
+                evaluateExpression(compiled[e], columns, lengths[l], results);
+                if (std::vector<bool>(results, results + lengths[l]) != evaluated[e*lengthCount + l])
+                {
+                    cerr << "Self-check failed: evaluateExpression (" << name << ") of \"" << expressions[e] << "\" on "
+                         << lengths[l] << " elements" << endl;
+                    ok = false;
+                }
+            }
+            for (int offset = 0; offset < 64; offset++)
+            {
+                if (findByte(&bytes[offset], &bytes[offset] + lengths[l], '\n') != found[64*l + offset])
+                {
+                    cerr << "Self-check failed: findByte (" << name << ") of " << lengths[l] << " bytes" << endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    setSimdBackend(saved);
+    return ok;
+}
+
+// Checks that a partitioned list written to a partition file reads back the same, and that opening one whose header
+// has been damaged in each of the ways 'openPartitionFile' checks for fails rather than handing out a bad payload
+static bool checkPartitionFiles()
+{
+    char path[] = "/tmp/stablepartition-check-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        cerr << "Self-check failed: could not create a temporary partition file: " << strerror(errno) << endl;
+        return false;
+    }
+    close(fd);
+    
+    std::vector<int> list(10000);
+    for (int i = 0; i < (int)list.size(); i++)
+        list[i] = rand();
+    int trues = (int)(std::stable_partition(list.begin(), list.end(), isEven) - list.begin());
+    
+    bool ok = writePartitionFile(path, list, trues);
+    PartitionFileView view;
+    std::string error;
+    if (ok && openPartitionFile(path, view, true, error))
+    {
+        const int* elements = partitionFileElements<int>(view);
+        ok = elements != NULL && partitionFileElements<double>(view) == NULL &&
+             view.header->count == list.size() && view.header->partitionPoint == (uint64_t)trues &&
+             std::equal(list.begin(), list.end(), elements);
+        closePartitionFile(view);
+    }
+    else
+        ok = false;
+    if (!ok)
+        cerr << "Self-check failed: partition file round trip" << endl;
+    
+    // each damage is applied to a freshly written file: a field overwritten at its offset in the header, and the file
+    // cut short or, so that only the damaged field is wrong, lengthened. Only the checksum damage is looked for with
+    // the checksum verified, since verifying would catch most of the others too.
+    struct Damage
+    {
+        const char* name;
+        size_t offset;
+        uint64_t value;
+        int size;
+        off_t truncateTo;
+        bool verify;
+    };
+    const Damage damages[] =
+    {
+        { "bad magic", 0, 0x58, 1, -1, false },
+        { "bad version", 8, 2, 4, -1, false },
+        { "zero element size", 12, 0, 4, -1, false },
+        { "count past the end", 16, 20000, 8, -1, false },
+        { "partition point past the count", 24, 10001, 8, -1, false },
+        { "misaligned payload", 32, 68, 8, 64 + 4*10000 + 64, false },
+        { "payload inside the header", 32, 0, 8, 64 + 4*10000 + 64, false },
+        { "payload past the end", 32, 1 << 20, 8, -1, false },
+        { "checksum mismatch", 40, 1, 8, -1, true },
+        { "truncated header", 0, 0, 0, 63, false },
+        { "truncated payload", 0, 0, 0, 64 + 4*9999, false },
+        { "empty file", 0, 0, 0, 0, false }
+    };
+    for (int d = 0; d < (int)(sizeof(damages)/sizeof(damages[0])); d++)
+    {
+        bool damaged = writePartitionFile(path, list, trues);
+        fd = open(path, O_RDWR);
+        damaged = damaged && fd >= 0;
+        if (damaged && damages[d].size > 0)
+        {
+            unsigned char byte = (unsigned char)damages[d].value;
+            uint32_t word = (uint32_t)damages[d].value;
+            const void* field = damages[d].size == 1 ? (const void*)&byte :
+                                damages[d].size == 4 ? (const void*)&word : (const void*)&damages[d].value;
+            damaged = pwrite(fd, field, (size_t)damages[d].size, (off_t)damages[d].offset) == damages[d].size;
+        }
+        if (damaged && damages[d].truncateTo >= 0)
+            damaged = ftruncate(fd, damages[d].truncateTo) == 0;
+        if (fd >= 0)
+            close(fd);
+        
+        if (!damaged || openPartitionFile(path, view, damages[d].verify, error))
+        {
+            if (damaged)
+                closePartitionFile(view);
+            cerr << "Self-check failed: partition file with " << damages[d].name << " was accepted" << endl;
+            ok = false;
+        }
+    }
+    
+    unlink(path);
+    return ok;
+}
+
+// Names of the rotation algorithms, in the order of RotateAlgorithm
+static const char* const rotateAlgorithmNames[] = { "auto", "reversal", "blockswap", "cycleleader", "buffered", "remap" };
+
+// Checks every rotation algorithm against std::rotate on lists of 'count' distinct values, over the whole list and a
+// range inside it, by no shift, shifts of one either way, half the range and a shift sharing a factor of 4 with it
+template<typename T>
+static bool checkRotationsOf(const std::vector<T>& values, const char* typeName)
+{
+    int count = (int)values.size();
+    bool ok = true;
+    
+    for (int range = 0; range < 2; range++)
+    {
+        int low = range == 0 ? 0 : count/5;
+        int high = range == 0 ? count-1 : count-1 - count/7;
+        int length = high+1 - low;
+        const int shifts[] = { 0, 1, length-1, length/2, length - length % 4 - 4 };
+        
+        for (int s = 0; s < (int)(sizeof(shifts)/sizeof(shifts[0])); s++)
+        {
+            if (shifts[s] < 0 || shifts[s] > length)
+                continue;
+            std::vector<T> expected = values;
+            std::rotate(expected.begin() + low, expected.begin() + low + shifts[s], expected.begin() + high+1);
+            
+            for (int algorithm = ROTATE_AUTO; algorithm <= ROTATE_REMAP; algorithm++)
+            {
+                std::vector<T> list = values;
+                rotate(list, low, low + shifts[s], high, (RotateAlgorithm)algorithm);
+                if (list != expected)
+                {
+                    cerr << "Self-check failed: rotate " << rotateAlgorithmNames[algorithm] << " on " << count << " " << typeName
+                         << " by " << shifts[s] << " in [" << low << ", " << high << "]" << endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// Checks the rotation algorithms on ints and strings, at lengths either side of the sizes 'smallrotate' switches at
+static bool checkRotations()
+{
+    const int counts[] = { 1, 2, 3, 8, 255, 256, 257, 1000, 4099, 100000 };
+    bool ok = true;
+    for (int c = 0; c < (int)(sizeof(counts)/sizeof(counts[0])); c++)
+    {
+        std::vector<int> ints(counts[c]);
+        std::vector<std::string> strings(counts[c]);
+        for (int i = 0; i < counts[c]; i++)
+        {
+            ints[i] = i;
+            strings[i] = std::to_string(i);
+        }
+        ok &= checkRotationsOf(ints, "ints");
+        ok &= checkRotationsOf(strings, "strings");
+    }
+    return ok;
+}
+
+// Orders (key, original index) pairs by key alone
+static bool keyLess(const std::pair<int, int>& a, const std::pair<int, int>& b)
+{
+    return a.first < b.first;
+}
+
+// Checks 'inplacemerge' against std::inplace_merge, including with either range empty. Keys are drawn from a few
+// values so there are plenty of equal ones, each carrying its original index so that stability shows in the result.
+static bool checkMerges()
+{
+    typedef std::pair<int, int> Keyed;
+    const int counts[] = { 0, 1, 2, 5, 64, 1000, 100000 };
+    const int keyRanges[] = { 3, 1000 };
+    bool ok = true;
+    
+    for (int c = 0; c < (int)(sizeof(counts)/sizeof(counts[0])); c++)
+    {
+        int count = counts[c];
+        const int splits[] = { 0, count/3, count/2, count };
+        
+        for (int k = 0; k < 2; k++)
+        {
+            for (int s = 0; s < 4; s++)
+            {
+                std::vector<Keyed> list(count);
+                for (int i = 0; i < count; i++)
+                    list[i] = Keyed(rand() % keyRanges[k], i);
+                
+                std::stable_sort(list.begin(), list.begin() + splits[s], keyLess);
+                std::stable_sort(list.begin() + splits[s], list.end(), keyLess);
+                
+                std::vector<Keyed> expected = list;
+                std::inplace_merge(expected.begin(), expected.begin() + splits[s], expected.end(), keyLess);
+                inplacemerge(list, 0, splits[s], count-1, keyLess);
+                
+                if (list != expected)
+                {
+                    cerr << "Self-check failed: inplacemerge of " << splits[s] << " and " << count - splits[s]
+                         << " elements" << endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// Checks 'mergepartitioned' and 'parallelmergepartitioned' against std::stable_partition on pointers into an array
+// split into shards of random lengths, some of them empty, and 'parallelmergepartitioned' with no bounds or one
+static bool checkMergePartitioned()
+{
+    bool ok = true;
+    for (int shards = 0; shards <= 9; shards++)
+    {
+        int count = shards == 0 ? 0 : rand() % 5000;
+        std::vector<int> list(count);
+        for (int i = 0; i < count; i++)
+            list[i] = rand();
+        std::vector<int> expected = list;
+        int* base = list.data();
+        
+        std::vector<int> cuts;
+        for (int s = 1; s < shards; s++)
+            cuts.push_back(rand() % 3 == 0 ? 0 : rand() % (count+1));
+        std::sort(cuts.begin(), cuts.end());
+        
+        std::vector<int*> bounds;
+        if (shards > 0)
+        {
+            bounds.push_back(base);
+            for (size_t s = 0; s < cuts.size(); s++)
+                bounds.push_back(base + cuts[s]);
+            bounds.push_back(base + count);
+        }
+        for (size_t s = 0; s+1 < bounds.size(); s++)
+            std::stable_partition(bounds[s], bounds[s+1], isEven);
+        
+        int* point = shards == 2 ? mergepartitioned(bounds[0], bounds[1], bounds[2], isEven)
+                                 : parallelmergepartitioned(bounds, isEven);
+        int expectedPoint = (int)(std::stable_partition(expected.begin(), expected.end(), isEven) - expected.begin());
+        
+        if (list != expected || (shards > 0 && point - base != expectedPoint) || (shards == 0 && point != NULL))
+        {
+            cerr << "Self-check failed: " << (shards == 2 ? "mergepartitioned" : "parallelmergepartitioned") << " of "
+                 << shards << " shards" << endl;
+            ok = false;
+        }
+    }
+    
+    int value = 0;
+    std::vector<int*> single(1, &value);
+    if (parallelmergepartitioned(single, isEven) != &value)
+    {
+        cerr << "Self-check failed: parallelmergepartitioned of a single bound" << endl;
+        ok = false;
+    }
+    return ok;
+}
+
+// Checks that a rope kept through rounds of partitioning and rotation stays equal to a vector put through the same
+// operations, and that merging short segments keeps it to at most a few segments per chunk's worth of elements
+static bool checkRopeSegments()
+{
+    const int count = 200000;
+    const int chunkSize = 256;
+    std::vector<int> expected(count);
+    for (int i = 0; i < count; i++)
+        expected[i] = rand();
+    
+    Rope<int> rope;
+    makeRope(expected, chunkSize, rope);
+    
+    bool ok = true;
+    for (int bit = 0; bit < 12 && ok; bit++)
+    {
+        stablepartition(rope, [bit](int x) { return (x >> bit & 1) != 0; });
+        std::stable_partition(expected.begin(), expected.end(), [bit](int x) { return (x >> bit & 1) != 0; });
+        
+        for (int r = 0; r < 20; r++)
+        {
+            int low = rand() % count;
+            int high = low + rand() % (count - low);
+            int middle = low + rand() % (high+1 - low);
+            rotate(rope, low, middle, high);
+            if (middle > low)
+                std::rotate(expected.begin() + low, expected.begin() + middle, expected.begin() + high+1);
+        }
+        
+        std::vector<RopeNode<int>*> segments;
+        ropeSegments(rope.root, segments);
+        ok = (int)segments.size() == rope.segments && rope.segments <= 16*(count/chunkSize + 1) + 32;
+    }
+    
+    std::vector<int> list;
+    flattenRope(rope, list);
+    ok &= list == expected;
+    if (!ok)
+        cerr << "Self-check failed: rope segments" << endl;
+    return ok;
+}
+
+// Checks rotation by remapping against std::rotate on a list big enough to be remapped, by whole numbers of pages
+// (including over and over, as a workload that keeps rotating the same list would) and by amounts it must copy
+static bool checkRemapRotate()
+{
+    int pageInts = (int)(sysconf(_SC_PAGESIZE) / sizeof(int));
+    int count = (int)(((size_t)40 << 20) / sizeof(int));
+    std::vector<int> values(count);
+    for (int i = 0; i < count; i++)
+        values[i] = i;
+    
+    const int shifts[] = { pageInts, 37*pageInts, count - 5*pageInts, count/2 - count/2 % pageInts, 1000, count-1 };
+    bool ok = true;
+    for (int s = 0; s < (int)(sizeof(shifts)/sizeof(shifts[0])); s++)
+    {
+        std::vector<int> list = values;
+        std::vector<int> expected = values;
+        rotate(list, 0, shifts[s], count-1, ROTATE_REMAP);
+        std::rotate(expected.begin(), expected.begin() + shifts[s], expected.end());
+        ok &= list == expected;
+    }
+    
+    std::vector<int> list = values;
+    long long total = 0;
+    for (int r = 0; r < 100; r++)
+    {
+        int middle = (1 + r % 37) * pageInts;
+        rotate(list, 0, middle, count-1, ROTATE_REMAP);
+        total += middle;
+    }
+    for (int i = 0; i < count && ok; i++)
+        ok = list[i] == (int)((i + total) % count);
+    
+    if (!ok)
+        cerr << "Self-check failed: rotate remap" << endl;
+    return ok;
+}
+
+// Runs the partitioning functions on a list of strings and checks each against std::stable_partition
+static bool checkPartitions(int count)
+{
+    std::vector<std::string> strings(count);
+    for (int i = 0; i < count; i++)
+        strings[i] = std::to_string(rand() % 1000);
+    
+    std::vector<std::string> expected = strings;
+    std::stable_partition(expected.begin(), expected.end(), isEvenString);
+    
+    typedef std::vector<std::string> Strings;
+    bool ok = true;
+    ok &= checkOnCopy("stablepartition", strings, expected, [](Strings& list) { stablepartition(list, isEvenString); });
+    ok &= checkOnCopy("stablepartitionbuffered", strings, expected,
+                      [](Strings& list) { stablepartitionbuffered(list, isEvenString); });
+    ok &= checkOnCopy("stablepartitionclustered", strings, expected,
+                      [](Strings& list) { stablepartitionclustered(list, isEvenString); });
+    ok &= checkOnCopy("stablepartitionwriteonce", strings, expected,
+                      [](Strings& list) { stablepartitionwriteonce(list, isEvenString); });
+    ok &= checkOnCopy("stablepartitionparallel", strings, expected,
+                      [](Strings& list) { stablepartitionparallel(list, isEvenString, 4); });
+    ok &= checkContainers(strings, expected);
+    const int counts[] = { 0, 1, 2, 63, 1000, count };
+    for (int c = 0; c < 6; c++)
+    {
+        ok &= checkStabilities(strings, std::min(counts[c], count));
+        ok &= checkUnpartitions(strings, std::min(counts[c], count));
+    }
+    ok &= checkVectorKernels();
+    ok &= checkPartitionFiles();
+    const int selectionCounts[] = { 0, 1, 7, 64, 4095, 4096, 4097, 100000 };
+    for (int c = 0; c < 8; c++)
+    {
+        ok &= checkSelections(selectionCounts[c], 2);
+        ok &= checkSelections(selectionCounts[c], 50);
+    }
+    ok &= checkRotations();
+    ok &= checkMerges();
+    ok &= checkMergePartitioned();
+    ok &= checkRopeSegments();
+    ok &= checkRemapRotate();
+    return ok;
+}
+
+// Times the rotation, merging and partitioning functions on 'count' random ints
+static int runBenchmarks(int count)
+{
+    if (count < 1000)
+    {
+        cerr << "Benchmarks need at least 1000 elements" << endl;
+        return 1;
+    }
+    
+    if (!checkPartitions(100000))
+        return 1;
+    
+    std::vector<int> values(count);
+    for (int i = 0; i < count; i++)
+        values[i] = rand();
+    
+    const int shifts[] = { count/2, count/3, 100, std::min(1 << 20, count/2) };
+    const char* shiftNames[] = { "n/2", "n/3", "100", "2^20" };
+    
+    cout.setf(std::ios::fixed);
+    cout.precision(1);
+    
+    for (int s = 0; s < 4; s++)
+    {
+        int middle = shifts[s];
+        for (int algorithm = ROTATE_AUTO; algorithm <= ROTATE_REMAP; algorithm++)
+        {
+            double ms = timeOnCopy(values, [&](std::vector<int>& list)
+                { rotate(list, 0, middle, count-1, (RotateAlgorithm)algorithm); });
+            cout << "rotate " << rotateAlgorithmNames[algorithm] << " by " << shiftNames[s] << ": " << ms << " ms" << endl;
+        }
+        double ms = timeOnCopy(values, [&](std::vector<int>& list)
+            { std::rotate(list.begin(), list.begin() + middle, list.end()); });
+        cout << "std::rotate by " << shiftNames[s] << ": " << ms << " ms" << endl;
+    }
+    
+    std::vector<int> halves = values;
+    std::sort(halves.begin(), halves.begin() + count/2);
+    std::sort(halves.begin() + count/2, halves.end());
+    cout << "inplacemerge: "
+         << timeOnCopy(halves, [&](std::vector<int>& list) { inplacemerge(list, 0, count/2, count-1); }) << " ms" << endl;
+    cout << "std::inplace_merge: "
+         << timeOnCopy(halves, [&](std::vector<int>& list)
+            { std::inplace_merge(list.begin(), list.begin() + count/2, list.end()); }) << " ms" << endl;
+    cout << "rotation merge without a buffer: "
+         << timeOnCopy(halves, [&](std::vector<int>& list)
+            { mergeWithoutBuffer(list.begin(), list.begin() + count/2, list.end()); }) << " ms" << endl;
+    
+    cout << "stablepartition: "
+         << timeOnCopy(values, [](std::vector<int>& list) { stablepartition(list, isEven); }) << " ms" << endl;
+    cout << "stablepartitionbuffered: "
+         << timeOnCopy(values, [](std::vector<int>& list) { stablepartitionbuffered(list, isEven); }) << " ms" << endl;
+    cout << "stablepartitionclustered: "
+         << timeOnCopy(values, [](std::vector<int>& list) { stablepartitionclustered(list, isEven); }) << " ms" << endl;
+    cout << "stablepartitionwriteonce: "
+         << timeOnCopy(values, [](std::vector<int>& list) { stablepartitionwriteonce(list, isEven); }) << " ms" << endl;
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    cout << "stablepartitionparallel (" << threads << " threads): "
+         << timeOnCopy(values, [&](std::vector<int>& list) { stablepartitionparallel(list, isEven, threads); }) << " ms" << endl;
+    cout << "semistablepartition: "
+         << timeOnCopy(values, [](std::vector<int>& list) { stablepartition(list, isEven, STABLE_TRUES); }) << " ms" << endl;
+    cout << "unstablepartition: "
+         << timeOnCopy(values, [](std::vector<int>& list) { stablepartition(list, isEven, UNSTABLE); }) << " ms" << endl;
+    cout << "std::stable_partition: "
+         << timeOnCopy(values, [](std::vector<int>& list) { std::stable_partition(list.begin(), list.end(), isEven); }) << " ms" << endl;
+    
+    std::vector<uint64_t> selection;
+    makeSelection(values, isEven, selection);
+    std::vector<int> partitioned = values;
+    stablepartition(partitioned, isEven);
+    cout << "stablepartition by selection: "
+         << timeOnCopy(values, [&](std::vector<int>& list) { stablepartition(list, selection); }) << " ms" << endl;
+    cout << "stablepartitioncompact: "
+         << timeOnCopy(values, [&](std::vector<int>& list) { stablepartitioncompact(list, selection); }) << " ms" << endl;
+    cout << "stableunpartition: "
+         << timeOnCopy(partitioned, [&](std::vector<int>& list) { stableunpartition(list, selection); }) << " ms" << endl;
+    cout << "stableunpartitionparallel (" << threads << " threads): "
+         << timeOnCopy(partitioned, [&](std::vector<int>& list) { stableunpartitionparallel(list, selection, threads); })
+         << " ms" << endl;
+    
+    // Clustered data, in runs of 50,000 'true' or 'false' elements
+    std::vector<int> clustered(count);
+    for (int i = 0; i < count; i++)
+        clustered[i] = values[i] / 2 * 2 + (i / 50000) % 2;
+    benchmarkCalls(clustered, "stablepartition on clustered data",
+                   [](std::vector<int>& list) { stablepartition(list, countingIsEven); });
+    benchmarkCalls(clustered, "stablepartitionclustered on clustered data",
+                   [](std::vector<int>& list) { stablepartitionclustered(list, countingIsEven); });
+    benchmarkCalls(clustered, "std::stable_partition on clustered data",
+                   [](std::vector<int>& list) { std::stable_partition(list.begin(), list.end(), countingIsEven); });
+    
+    // The chunked list only moves whole chunks where the runs of 'true' and 'false' records are whole chunks
+    const int chunkSize = 1024;
+    std::vector<BenchmarkRecord> records(std::min(count, 1 << 20));
+    for (int i = 0; i < (int)records.size(); i++)
+        records[i].key = values[i];
+    benchmarkContainers(records, chunkSize, "random");
+    for (int i = 0; i < (int)records.size(); i++)
+        records[i].key = values[i / chunkSize * chunkSize];
+    benchmarkContainers(records, chunkSize, "runs of whole chunks");
+    
+    cout.precision(2);
+    cout << "stablepartition writes per element: "
+         << writesOnCopy(values, [](std::vector<CountedInt>& list) { stablepartition(list, countedIsEven); }) << endl;
+    cout << "stablepartitionbuffered writes per element: "
+         << writesOnCopy(values, [](std::vector<CountedInt>& list) { stablepartitionbuffered(list, countedIsEven); }) << endl;
+    cout << "stablepartitionwriteonce writes per element: "
+         << writesOnCopy(values, [](std::vector<CountedInt>& list) { stablepartitionwriteonce(list, countedIsEven); }) << endl;
+    cout << "std::stable_partition writes per element: "
+         << writesOnCopy(values, [](std::vector<CountedInt>& list)
+            { std::stable_partition(list.begin(), list.end(), countedIsEven); }) << endl;
+    return 0;
+}
+
+// Command line tool: maps the input file, splits it into line records that point into the mapping, evaluates the
+// predicate once per line, stably partitions the records, and writes each section out.
+int runCommandLine(int argc, char* argv[])
+{
+    const char* predicate = NULL;
+    int column = -1;
+    char delimiter = ',';
+    const char* binaryPath = NULL;
+    std::vector<const char*> paths;
+    
+    if (argc == 3 && strcmp(argv[1], "-s") == 0)
+        return describePartitionFile(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "-t") == 0)
+        return runBenchmarks(atoi(argv[2]));
+    
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+            predicate = argv[++i];
+        else if (strcmp(argv[i], "-k") == 0 && i+1 < argc)
+            column = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i+1 < argc)
+            delimiter = argv[++i][0];
+        else if (strcmp(argv[i], "-b") == 0 && i+1 < argc)
+            binaryPath = argv[++i];
+        else if (strcmp(argv[i], "-v") == 0 && i+1 < argc)
+        {
+            const char* name = argv[++i];
+            int backend = SIMD_SCALAR;
+            while (backend <= SIMD_NEON && strcmp(name, simdBackendName((SimdBackend)backend)) != 0)
+                backend++;
+            if (backend > SIMD_NEON || !setSimdBackend((SimdBackend)backend))
+            {
+                cerr << "Vector kernels " << name << " are not supported by this build" << endl;
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+        else
+            paths.push_back(argv[i]);
+    }
+    
+    if (predicate == NULL || paths.empty() || paths.size() > (binaryPath != NULL ? 1 : 3))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    // text output goes to standard output unless output files are given
+    std::vector<const char*> files = paths;
+    if (binaryPath == NULL && files.size() == 1)
+        files.push_back("-");
+    for (size_t i = 1; i < files.size(); i++)
+    {
+        for (size_t j = 0; j < i; j++)
+        {
+            if (sameFile(files[i], files[j]))
+            {
+                cerr << "Output " << files[i] << " is the same file as " << files[j] << endl;
+                return 1;
+            }
+        }
+    }
+    
+    Expression expr;
+    std::string error;
+    if (!compileExpression(predicate, expr, error))
+    {
+        cerr << "Invalid predicate \"" << predicate << "\": " << error << endl;
+        return 1;
+    }
+    
+    size_t size = 0;
+    const char* data = mapInputFile(paths[0], size);
+    if (data == NULL)
+    {
+        cerr << "Could not read " << paths[0] << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    
+    std::vector<Record> records;
+    splitLines(data, size, records);
+    
+    // evaluate the predicate a block of lines at a time: parse the key field of each line into the x and c
+    // columns, then run the compiled expression over the whole block
+    const int block = 4096;
+    std::vector<int> xs(block), cs(block);
+    bool results[block];
+    const int* columns[2] = { &xs[0], &cs[0] };
+    
+    // for binary output only the keys are needed, and they can be partitioned as they are parsed by compacting
+    // each block's 'true' and 'false' keys onto the ends of two lists
+    std::vector<int> trueKeys, falseKeys;
+    
+    int trueCount = 0;
+    for (int start = 0; start < (int)records.size(); start += block)
+    {
+        int n = std::min(block, (int)records.size() - start);
+        for (int i = 0; i < n; i++)
+        {
+            const Record& line = records[start+i];
+            Record key = column < 0 ? line : fieldOf(line, column, delimiter);
+            xs[i] = parseInt(key);
+            cs[i] = key.length > 0 ? (unsigned char)key.data[0] : 0;
+        }
+        
+        evaluateExpression(expr, columns, n, results);
+        
+        if (binaryPath != NULL)
+        {
+            size_t trueEnd = trueKeys.size(), falseEnd = falseKeys.size();
+            trueKeys.resize(trueEnd + n);
+            falseKeys.resize(falseEnd + n);
+            trueKeys.resize(trueEnd + compactInts(&xs[0], results, n, true, &trueKeys[trueEnd]));
+            falseKeys.resize(falseEnd + compactInts(&xs[0], results, n, false, &falseKeys[falseEnd]));
+            continue;
+        }
+        
+        for (int i = 0; i < n; i++)
+        {
+            records[start+i].selected = results[i];
+            trueCount += results[i];
+        }
+    }
+    
+    if (binaryPath != NULL)
+    {
+        unmapInputFile(data, size);
+        
+        trueCount = (int)trueKeys.size();
+        trueKeys.insert(trueKeys.end(), falseKeys.begin(), falseKeys.end());
+        if (!writePartitionFile<int>(binaryPath, trueKeys, trueCount))
+        {
+            cerr << "Could not write " << binaryPath << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        return 0;
+    }
+    
+    stablepartition<Record>(records, recordSelected);
+    
+    int trueFd = openOutput(paths.size() > 1 ? paths[1] : "-");
+    int falseFd = paths.size() > 2 && trueFd >= 0 ? openOutput(paths[2]) : trueFd;
+    if (trueFd < 0 || falseFd < 0)
+    {
+        cerr << "Could not open output: " << strerror(errno) << endl;
+        if (trueFd >= 0 && trueFd != STDOUT_FILENO)
+            close(trueFd);
+        unmapInputFile(data, size);
+        return 1;
+    }
+    
+    // two names for a file that did not exist until it was opened above
+    if (paths.size() > 2 && sameFile(paths[1], paths[2]))
+    {
+        cerr << "Output " << paths[2] << " is the same file as " << paths[1] << endl;
+        if (falseFd != STDOUT_FILENO)
+            close(falseFd);
+        if (trueFd != STDOUT_FILENO)
+            close(trueFd);
+        unmapInputFile(data, size);
+        return 1;
+    }
+    
+    bool ok = writeRecords(trueFd, records, 0, trueCount) &&
+              writeRecords(falseFd, records, trueCount, (int)records.size());
+    
+    if (falseFd != trueFd && falseFd != STDOUT_FILENO)
+        close(falseFd);
+    if (trueFd != STDOUT_FILENO)
+        close(trueFd);
+    unmapInputFile(data, size);
+    
+    if (!ok)
+    {
+        cerr << "Could not write output: " << strerror(errno) << endl;
+        return 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        return runCommandLine(argc, argv);
+    
     srand((unsigned int)time(NULL));
     
     // Example usage 1 - int vector, partition based on whether values are even or odd